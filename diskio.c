@@ -9,7 +9,11 @@
 
 #include "ff.h"			/* Basic definitions of FatFs */
 #include "diskio.h"		/* Declarations FatFs MAI */
-#include "spi.h"
+#include "sd.h"			/* SD card over spidev */
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 /* Example: Declarations of the platform and disk functions in the project */
 //#include "platform.h"
@@ -20,6 +24,291 @@
 #define DEV_MMC		1	/* Map MMC/SD card to physical drive 1 */
 #define DEV_USB		2	/* Map USB MSD to physical drive 2 */
 
+/* Write-combining buffer: FatFs writes most metadata and partial file
+   sectors one at a time. Contiguous single-sector writes are held here and
+   sent to the card as one multi-block write when the run breaks, the buffer
+   fills up, or FatFs asks for CTRL_SYNC. */
+#ifndef WCB_SECTORS
+#define WCB_SECTORS	16	/* Max sectors held in the buffer (0:disable) */
+#endif
+
+/* Sector zeroing (CTRL_ZERO): SD cards whose SCR says erased blocks read as
+   zeros are erased with CMD32/33/38 in whole erase units of the CSD, the rest
+   of the range and other drives get multi-sector writes from a zero buffer
+   shared by all drives. */
+#ifndef ZERO_SECTORS
+#define ZERO_SECTORS	64	/* Size of the zero buffer [sectors] */
+#endif
+
+/* Block I/O tracer: when started with disk_trace_start(), every disk_read,
+   disk_write and disk_ioctl call is logged to a binary file (disktrace.h)
+   that the replay tool can re-issue against any backend. */
+#ifndef DISKIO_TRACE
+#define DISKIO_TRACE	1	/* 0:Disable, 1:Enable (started at run time) */
+#endif
+
+#if DISKIO_TRACE
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "disktrace.h"
+#endif
+
+
+/* Context of a physical drive. Each drive has its own lock, so I/O to
+   different drives from different threads runs in parallel. */
+typedef struct {
+	pthread_mutex_t lock;	/* Serializes the calls to this drive */
+	int img_fd;				/* Disk image file descriptor (-1:not an image) */
+	const char* spidev;		/* SPI device of the SD card (null:no card) */
+	sd_dev_t sd;			/* SD card handle (sd.fd -1:not opened) */
+#if WCB_SECTORS
+	BYTE wcb_buf[WCB_SECTORS * 512];	/* Pending sector data */
+	LBA_t wcb_sect;			/* First sector of the pending run */
+	UINT wcb_count;			/* Number of sectors pending (0:empty) */
+#endif
+} DISKDEV;
+
+static DISKDEV Drives[FF_VOLUMES];
+static pthread_once_t DrivesOnce = PTHREAD_ONCE_INIT;
+#if FF_FS_READONLY == 0
+static BYTE ZeroBuf[ZERO_SECTORS * 512];	/* Never written */
+#endif
+
+#if DISKIO_TRACE
+static FILE *TraceFile;		/* Trace output (null:tracer stopped) */
+static atomic_int TraceOn;	/* TraceFile is set (tested without the lock on each call) */
+static uint64_t TraceT0;	/* Time the trace started [us] */
+static pthread_mutex_t TraceLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+
+static void drives_init (void)
+{
+	for (int i = 0; i < FF_VOLUMES; i++) {
+		pthread_mutex_init(&Drives[i].lock, 0);
+		Drives[i].img_fd = -1;
+		Drives[i].sd.fd = -1;
+	}
+	Drives[0].spidev = DEVICE;	/* Drive 0 is the card on the default SPI device */
+}
+
+
+static DISKDEV* get_drive (BYTE pdrv)	/* Locked drive context (null:invalid drive) */
+{
+	if (pdrv >= FF_VOLUMES) return 0;
+	pthread_once(&DrivesOnce, drives_init);
+	pthread_mutex_lock(&Drives[pdrv].lock);
+	return &Drives[pdrv];
+}
+
+
+static void put_drive (DISKDEV* dev)
+{
+	pthread_mutex_unlock(&dev->lock);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Backend Sector Access                                                 */
+/*-----------------------------------------------------------------------*/
+
+static DRESULT dev_read (DISKDEV* dev, BYTE *buff, LBA_t sector, UINT count)
+{
+    if (dev->img_fd >= 0) {
+        ssize_t len = (ssize_t)count * 512;
+        return pread(dev->img_fd, buff, len, (off_t)sector * 512) == len ? RES_OK : RES_ERROR;
+    }
+    for (UINT i = 0; i < count; i++) {
+        if (!sd_read_block(&dev->sd, sector + i, buff + i * 512)) {
+            return RES_ERROR;
+        }
+    }
+    return RES_OK;
+}
+
+
+static DRESULT dev_write (DISKDEV* dev, const BYTE *buff, LBA_t sector, UINT count)
+{
+    if (dev->img_fd >= 0) {
+        ssize_t len = (ssize_t)count * 512;
+        return pwrite(dev->img_fd, buff, len, (off_t)sector * 512) == len ? RES_OK : RES_ERROR;
+    }
+    return sd_write_blocks(&dev->sd, sector, buff, count) ? RES_OK : RES_ERROR;
+}
+
+
+static DRESULT dev_sync (DISKDEV* dev)
+{
+    if (dev->img_fd >= 0) {
+        return fdatasync(dev->img_fd) == 0 ? RES_OK : RES_ERROR;
+    }
+    return sd_sync(&dev->sd) ? RES_OK : RES_ERROR;	/* Wait for a pipelined write */
+}
+
+
+static DRESULT dev_close (DISKDEV* dev)	/* RES_OK:closed, RES_ERROR:pending data could not be written (the backend is kept) */
+{
+#if WCB_SECTORS
+    if (dev->wcb_count) {
+        UINT n = dev->wcb_count;
+
+        if (dev_write(dev, dev->wcb_buf, dev->wcb_sect, n) != RES_OK) return RES_ERROR;	/* Keep the run for another try */
+        dev->wcb_count = 0;
+    }
+#endif
+    if (dev_sync(dev) != RES_OK) return RES_ERROR;
+    if (dev->img_fd >= 0) close(dev->img_fd);
+    dev->img_fd = -1;
+    sd_close(&dev->sd);
+    dev->spidev = 0;
+    return RES_OK;
+}
+
+
+int disk_attach_image (
+	BYTE pdrv,			/* Physical drive number */
+	const char* path	/* Disk image file, null to detach the drive */
+)
+{
+	DISKDEV* dev = get_drive(pdrv);
+	int fd = -1, ok = 0;
+
+	if (!dev) return 0;
+	if (path) fd = open(path, O_RDWR);
+	if (!path || fd >= 0) {
+		if (dev_close(dev) == RES_OK) {
+			dev->img_fd = fd;
+			ok = 1;
+		} else if (fd >= 0) {
+			close(fd);	/* The previous backend still has unwritten data */
+		}
+	}
+	put_drive(dev);
+	return ok;
+}
+
+
+int disk_attach_sd (
+	BYTE pdrv,			/* Physical drive number */
+	const char* spidev	/* SPI device of the card (e.g. "/dev/spidev0.1", kept by reference), null to detach the drive */
+)
+{
+	DISKDEV* dev = get_drive(pdrv);
+	int ok = 0;
+
+	if (!dev) return 0;
+	if (dev_close(dev) == RES_OK) {
+		dev->spidev = spidev;	/* Opened by disk_initialize() */
+		ok = 1;
+	}
+	put_drive(dev);
+	return ok;
+}
+
+
+
+#if WCB_SECTORS
+/*-----------------------------------------------------------------------*/
+/* Flush the write-combining buffer                                      */
+/*-----------------------------------------------------------------------*/
+
+static DRESULT wcb_flush (DISKDEV* dev)
+{
+	UINT n = dev->wcb_count;
+
+	if (n == 0) return RES_OK;
+	dev->wcb_count = 0;	/* The run is dropped even on error, FatFs sees the error */
+	return dev_write(dev, dev->wcb_buf, dev->wcb_sect, n);
+}
+#endif
+
+
+
+#if DISKIO_TRACE
+/*-----------------------------------------------------------------------*/
+/* Block I/O Tracer                                                      */
+/*-----------------------------------------------------------------------*/
+
+static uint64_t trace_clock (void)	/* Monotonic time [us] */
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void trace_put (
+	BYTE op,		/* DT_READ, DT_WRITE or DT_IOCTL */
+	BYTE pdrv,		/* Physical drive number */
+	LBA_t sector,	/* Start sector (ioctl: 0) */
+	UINT count,		/* Number of sectors (ioctl: 0) */
+	BYTE cmd,		/* ioctl command code */
+	DRESULT res,	/* Result of the call */
+	uint64_t t0		/* Time the call was entered [us] */
+)
+{
+    DTREC rec;
+
+    rec.lba = sector;
+    rec.lat = (uint32_t)(trace_clock() - t0);
+    rec.count = count;
+    rec.op = op;
+    rec.pdrv = pdrv;
+    rec.cmd = cmd;
+    rec.res = (uint8_t)res;
+    pthread_mutex_lock(&TraceLock);
+    if (TraceFile) {	/* May have been stopped by another thread */
+        rec.ts = t0 - TraceT0;
+        fwrite(&rec, sizeof rec, 1, TraceFile);
+    }
+    pthread_mutex_unlock(&TraceLock);
+}
+
+
+int disk_trace_start (
+	const char* path	/* Trace file to create */
+)
+{
+    DTHDR hdr = { DT_MAGIC, DT_VERSION };
+    FILE *fp;
+
+    disk_trace_stop();
+    fp = fopen(path, "wb");
+    if (!fp) return 0;
+    setvbuf(fp, 0, _IOFBF, 64 * 1024);	/* Keep the tracer out of the latency */
+    fwrite(&hdr, sizeof hdr, 1, fp);
+    pthread_mutex_lock(&TraceLock);
+    TraceT0 = trace_clock();
+    TraceFile = fp;
+    atomic_store(&TraceOn, 1);
+    pthread_mutex_unlock(&TraceLock);
+    return 1;
+}
+
+
+void disk_trace_stop (void)
+{
+    pthread_mutex_lock(&TraceLock);
+    if (TraceFile) {
+        atomic_store(&TraceOn, 0);
+        fclose(TraceFile);
+        TraceFile = 0;
+    }
+    pthread_mutex_unlock(&TraceLock);
+}
+
+#define TRACE_BEGIN()	uint64_t t0 = atomic_load_explicit(&TraceOn, memory_order_relaxed) ? trace_clock() : 0
+#define TRACE_END(op, pdrv, sector, count, cmd, res)	if (t0) trace_put(op, pdrv, sector, count, cmd, res, t0)
+#else
+#define TRACE_BEGIN()
+#define TRACE_END(op, pdrv, sector, count, cmd, res)
+#endif
+
+
 
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
@@ -29,8 +318,17 @@ DSTATUS disk_status (
 	BYTE pdrv		/* Physical drive nmuber to identify the drive */
 )
 {
-	if (pdrv != 0) return STA_NOINIT;
-    return 0;
+	DISKDEV* dev = get_drive(pdrv);
+	DSTATUS st;
+
+	if (!dev) return STA_NOINIT;
+	if (dev->img_fd >= 0) {
+		st = 0;
+	} else {
+		st = dev->spidev ? (dev->sd.type ? 0 : STA_NOINIT) : STA_NODISK | STA_NOINIT;
+	}
+	put_drive(dev);
+	return st;
 }
 
 
@@ -43,8 +341,21 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
-	if (pdrv != 0) return STA_NOINIT;
-    return sd_init() ? 0 : STA_NOINIT;
+	DISKDEV* dev = get_drive(pdrv);
+	DSTATUS st = STA_NOINIT;
+
+	if (!dev) return STA_NOINIT;
+    if (dev->img_fd >= 0) {
+        st = 0;
+    } else if (dev->spidev) {
+        if (dev->sd.fd >= 0 || sd_open(&dev->sd, dev->spidev)) {
+            st = sd_init(&dev->sd) ? 0 : STA_NOINIT;
+        }
+    } else {
+        st = STA_NODISK | STA_NOINIT;
+    }
+	put_drive(dev);
+	return st;
 }
 
 
@@ -53,6 +364,24 @@ DSTATUS disk_initialize (
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
+static DRESULT read_drive (DISKDEV* dev, BYTE *buff, LBA_t sector, UINT count)
+{
+	DRESULT res;
+
+    res = dev_read(dev, buff, sector, count);
+#if WCB_SECTORS
+    /* Pending sectors are newer than the card's copy */
+    if (res == RES_OK && dev->wcb_count && sector < dev->wcb_sect + dev->wcb_count && dev->wcb_sect < sector + count) {
+        LBA_t s = (sector > dev->wcb_sect) ? sector : dev->wcb_sect;
+        LBA_t e = (sector + count < dev->wcb_sect + dev->wcb_count) ? sector + count : dev->wcb_sect + dev->wcb_count;
+
+        memcpy(buff + (s - sector) * 512, dev->wcb_buf + (s - dev->wcb_sect) * 512, (e - s) * 512);
+    }
+#endif
+    return res;
+}
+
+
 DRESULT disk_read (
 	BYTE pdrv,		/* Physical drive nmuber to identify the drive */
 	BYTE *buff,		/* Data buffer to store read data */
@@ -60,14 +389,16 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-	if (pdrv != 0) return RES_PARERR;
-
-    for (UINT i = 0; i < count; i++) {
-        if (!sd_read_block(sector + i, buff + i * 512)) {
-            return RES_ERROR;
-        }
-    }
-    return RES_OK;
+	DISKDEV* dev;
+	DRESULT res;
+	TRACE_BEGIN();
+
+	dev = get_drive(pdrv);
+	if (!dev) return RES_PARERR;
+	res = read_drive(dev, buff, sector, count);
+	put_drive(dev);
+	TRACE_END(DT_READ, pdrv, sector, count, 0, res);
+	return res;
 }
 
 
@@ -78,75 +409,148 @@ DRESULT disk_read (
 
 #if FF_FS_READONLY == 0
 
-DRESULT disk_write (
-	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
-	const BYTE *buff,	/* Data to be written */
-	LBA_t sector,		/* Start sector in LBA */
-	UINT count			/* Number of sectors to write */
-)
-{	
-	if (pdrv != 0) return RES_PARERR;
-	
-    for (UINT i = 0; i < count; i++) {
-        if (!sd_write_block(sector + i, buff + i * 512)) {
-            return RES_ERROR;
-        }
+static DRESULT write_drive (DISKDEV* dev, const BYTE *buff, LBA_t sector, UINT count)
+{
+#if WCB_SECTORS
+    if (dev->wcb_count && sector >= dev->wcb_sect && sector + count <= dev->wcb_sect + dev->wcb_count) {
+        /* Rewrite of sectors still pending, e.g. a FAT sector synced twice */
+        memcpy(dev->wcb_buf + (sector - dev->wcb_sect) * 512, buff, count * 512);
+        return RES_OK;
+    }
+    if (dev->wcb_count && (sector != dev->wcb_sect + dev->wcb_count || dev->wcb_count + count > WCB_SECTORS)) {
+        /* The run breaks or would overflow */
+        if (wcb_flush(dev) != RES_OK) return RES_ERROR;
     }
+    if (count >= WCB_SECTORS) {
+        /* Large writes are already batched by the caller */
+        return dev_write(dev, buff, sector, count);
+    }
+    if (dev->wcb_count == 0) dev->wcb_sect = sector;
+    memcpy(dev->wcb_buf + dev->wcb_count * 512, buff, count * 512);
+    dev->wcb_count += count;
+    if (dev->wcb_count == WCB_SECTORS) return wcb_flush(dev);
     return RES_OK;
-}
-
+#else
+    return dev_write(dev, buff, sector, count);
 #endif
+}
 
 
-/*-----------------------------------------------------------------------*/
-/* Miscellaneous Functions                                               */
-/*-----------------------------------------------------------------------*/
-
-DRESULT disk_ioctl (
-	BYTE pdrv,		/* Physical drive nmuber (0..) */
-	BYTE cmd,		/* Control code */
-	void *buff		/* Buffer to send/receive control data */
-)
+static DRESULT zero_write (DISKDEV* dev, LBA_t start, LBA_t end)
 {
-	/*
-	DRESULT res;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
+    UINT n;
 
-		// Process of the command for the RAM drive
+    for ( ; start <= end; start += n) {
+        n = (end - start + 1 < ZERO_SECTORS) ? (UINT)(end - start + 1) : ZERO_SECTORS;
+        if (dev_write(dev, ZeroBuf, start, n) != RES_OK) return RES_ERROR;
+    }
+    return RES_OK;
+}
 
-		return res;
 
-	case DEV_MMC :
+static DRESULT zero_drive (DISKDEV* dev, LBA_t start, LBA_t end)
+{
+    LBA_t es, ee;
+    UINT u;
 
-		// Process of the command for the MMC/SD card
+    if (end < start) return RES_PARERR;
+#if WCB_SECTORS
+    if (wcb_flush(dev) != RES_OK) return RES_ERROR;	/* Pending sectors must not land on the zeros */
+#endif
+    if (dev->img_fd < 0 && dev->sd.erase_zero) {	/* Erase the whole erase units in the range and write zeros over the rest */
+        u = dev->sd.erase_unit;
+        es = (start + u - 1) / u * u;
+        ee = (end + 1) / u * u;	/* End of the erase units (exclusive) */
+        if (es < ee) {
+            if (!sd_erase(&dev->sd, (uint32_t)es, (uint32_t)(ee - 1))) return RES_ERROR;
+            if (es > start && zero_write(dev, start, es - 1) != RES_OK) return RES_ERROR;
+            return (ee <= end) ? zero_write(dev, ee, end) : RES_OK;
+        }
+    }
+    return zero_write(dev, start, end);
+}
 
-		return res;
 
-	case DEV_USB :
+DRESULT disk_write (
+	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
+	const BYTE *buff,	/* Data to be written */
+	LBA_t sector,		/* Start sector in LBA */
+	UINT count			/* Number of sectors to write */
+)
+{
+	DISKDEV* dev;
+	DRESULT res;
+	TRACE_BEGIN();
+
+	dev = get_drive(pdrv);
+	if (!dev) return RES_PARERR;
+	res = write_drive(dev, buff, sector, count);
+	put_drive(dev);
+	TRACE_END(DT_WRITE, pdrv, sector, count, 0, res);
+	return res;
+}
 
-		// Process of the command the USB drive
+#endif
 
-		return res;
-	}
 
-	return RES_PARERR;
-	*/
-	if (pdrv != 0) return RES_PARERR;
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
 
+static DRESULT ioctl_drive (DISKDEV* dev, BYTE cmd, void *buff)
+{
     switch (cmd) {
     case CTRL_SYNC:
-        return RES_OK;
+#if WCB_SECTORS
+        if (wcb_flush(dev) != RES_OK) return RES_ERROR;
+#endif
+        return dev_sync(dev);
+    case GET_SECTOR_COUNT:
+        if (dev->img_fd >= 0) {
+            off_t sz = lseek(dev->img_fd, 0, SEEK_END);
+            if (sz < 0) return RES_ERROR;
+            *(LBA_t*)buff = (LBA_t)(sz / 512);
+            return RES_OK;
+        }
+        return RES_PARERR;
     case GET_SECTOR_SIZE:
         *(WORD*)buff = 512;
         return RES_OK;
     case GET_BLOCK_SIZE:
         *(DWORD*)buff = 1;
         return RES_OK;
+#if FF_FS_READONLY == 0
+    case CTRL_ZERO:
+        return zero_drive(dev, ((LBA_t*)buff)[0], ((LBA_t*)buff)[1]);
+#endif
+    case MMC_GET_TYPE:
+        if (dev->img_fd >= 0 || !dev->sd.type) return RES_NOTRDY;
+        *(BYTE*)buff = (BYTE)dev->sd.type;
+        return RES_OK;
     default:
         return RES_PARERR;
     }
 }
 
+
+DRESULT disk_ioctl (
+	BYTE pdrv,		/* Physical drive nmuber (0..) */
+	BYTE cmd,		/* Control code */
+	void *buff		/* Buffer to send/receive control data */
+)
+{
+	DISKDEV* dev;
+	DRESULT res;
+	TRACE_BEGIN();
+
+	dev = get_drive(pdrv);
+	if (!dev) return RES_PARERR;
+	res = ioctl_drive(dev, cmd, buff);
+	put_drive(dev);
+	if ((cmd == CTRL_TRIM || cmd == CTRL_ZERO) && buff) {	/* Keep the trimmed/zeroed range so that it can be replayed */
+		TRACE_END(DT_IOCTL, pdrv, ((LBA_t*)buff)[0], (UINT)(((LBA_t*)buff)[1] - ((LBA_t*)buff)[0] + 1), cmd, res);
+	} else {
+		TRACE_END(DT_IOCTL, pdrv, 0, 0, cmd, res);
+	}
+	return res;
+}
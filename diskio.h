@@ -32,6 +32,11 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+/* Backend selection (not used by FatFs). The data pending for the previous backend is written
+   out before it is closed, and the call fails leaving it attached when that cannot be done. */
+int disk_attach_image (BYTE pdrv, const char* path);	/* Serve the drive from a disk image file (null:detach) */
+int disk_attach_sd (BYTE pdrv, const char* spidev);		/* Serve the drive from the SD card on an SPI device (null:detach) */
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -48,6 +53,7 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define GET_SECTOR_SIZE		2	/* Get sector size (needed at FF_MAX_SS != FF_MIN_SS) */
 #define GET_BLOCK_SIZE		3	/* Get erase block size (needed at FF_USE_MKFS == 1) */
 #define CTRL_TRIM			4	/* Inform device that the data on the block of sectors is no longer used (needed at FF_USE_TRIM == 1) */
+#define CTRL_ZERO			9	/* Fill a block of sectors with zeros (needed at FF_USE_ZERO == 1) */
 
 /* Generic command (Not used by FatFs) */
 #define CTRL_POWER			5	/* Get/Set power status */
@@ -0,0 +1,37 @@
+#ifndef DISKTRACE_H
+#define DISKTRACE_H
+
+#include <stdint.h>
+
+// Binary block I/O trace written by diskio.c (disk_trace_start) and read
+// back by the replay tool. The file is a DTHDR followed by one DTREC per
+// disk_read/disk_write/disk_ioctl call, in host byte order.
+
+#define DT_MAGIC   0x43525444   // "DTRC"
+#define DT_VERSION 2
+
+// Operation codes (DTREC.op)
+#define DT_READ  0
+#define DT_WRITE 1
+#define DT_IOCTL 2
+
+typedef struct {
+    uint32_t magic;     // DT_MAGIC
+    uint32_t version;   // DT_VERSION
+} DTHDR;
+
+typedef struct {
+    uint64_t ts;        // call start, microseconds since the trace started
+    uint64_t lba;       // first sector (CTRL_TRIM/CTRL_ZERO: first sector of the range)
+    uint32_t lat;       // time spent in the call, microseconds
+    uint32_t count;     // number of sectors (CTRL_TRIM/CTRL_ZERO: sectors in the range)
+    uint8_t  op;        // DT_READ, DT_WRITE or DT_IOCTL
+    uint8_t  pdrv;      // physical drive number
+    uint8_t  cmd;       // ioctl command code (DT_IOCTL only)
+    uint8_t  res;       // DRESULT returned by the call
+} DTREC;
+
+int disk_trace_start(const char *path);
+void disk_trace_stop(void);
+
+#endif
@@ -239,10 +239,19 @@
 #if FF_USE_LFN == 1
 #error Static LFN work area cannot be used in thread-safe configuration
 #endif
+#if FF_FS_REENTRANT == 2 && (!FF_FS_LOCK || FF_FS_TINY)
+#error FF_FS_REENTRANT == 2 needs FF_FS_LOCK > 0 and cannot be used at tiny buffer configuration
+#endif
 #define LEAVE_FF(fs, res)	{ unlock_volume(fs, res); return res; }
 #else
 #define LEAVE_FF(fs, res)	return res
 #endif
+#if FF_FS_REENTRANT == 2	/* Read functions hold only the object lock */
+#define LEAVE_RD(fs, res)	{ if (fs) ff_mutex_give(FF_VOLUMES + fp->obj.lockid); return res; }
+#else
+#define LEAVE_RD(fs, res)	LEAVE_FF(fs, res)
+#endif
+#define ABORT_RD(fs, res)	{ fp->err = (BYTE)(res); LEAVE_RD(fs, res); }
 
 
 /* Definitions of logical drive to physical location conversion */
@@ -266,6 +275,108 @@
 #endif
 
 
+/* Window cache */
+#if FF_WIN_CACHE < 0 || FF_WIN_CACHE > 16
+#error Wrong FF_WIN_CACHE setting
+#endif
+#if FF_WIN_CACHE && FF_FS_TINY
+#error FF_WIN_CACHE cannot be used at tiny buffer configuration
+#endif
+
+
+/* In-memory copy of the FAT */
+#if FF_FS_FATRAM < 0 || FF_FS_FATRAM > 1048576
+#error Wrong FF_FS_FATRAM setting
+#endif
+
+
+/* Cluster map of file object */
+#if FF_FS_EXTMAP < 0 || FF_FS_EXTMAP > 255
+#error Wrong FF_FS_EXTMAP setting
+#endif
+
+
+/* Write-behind buffer of file object */
+#if FF_USE_FILEBUF && FF_FS_TINY
+#error FF_USE_FILEBUF cannot be used at tiny buffer configuration
+#endif
+
+
+/* Sector buffer pool of file objects */
+#if FF_FS_BUFPOOL < 0 || FF_FS_BUFPOOL > 255
+#error Wrong FF_FS_BUFPOOL setting
+#endif
+#if FF_FS_BUFPOOL && (FF_FS_TINY || FF_FS_REENTRANT == 2)
+#error FF_FS_BUFPOOL cannot be used at tiny buffer configuration or FF_FS_REENTRANT == 2
+#endif
+#if FF_FS_BUFPOOL	/* The pool keeps the dirty state of each buffer to write it back when lent to another file */
+#define PB_SLOT(fp)		((UINT)(((fp)->buf - (fp)->obj.fs->pbbuf[0]) / FF_MAX_SS))	/* Index of the pool buffer held by the file object */
+#define SET_DIRTY(fp)	do { (fp)->flag |= FA_DIRTY; (fp)->obj.fs->pbflag[PB_SLOT(fp)] = 1; (fp)->obj.fs->pbsect[PB_SLOT(fp)] = (fp)->sect; } while (0)
+#define CLR_DIRTY(fp)	do { (fp)->flag &= (BYTE)~FA_DIRTY; (fp)->obj.fs->pbflag[PB_SLOT(fp)] = 0; } while (0)
+#else
+#define SET_DIRTY(fp)	do { (fp)->flag |= FA_DIRTY; } while (0)
+#define CLR_DIRTY(fp)	do { (fp)->flag &= (BYTE)~FA_DIRTY; } while (0)
+#endif
+
+
+/* Directory name index */
+#if FF_FS_DIRINDEX < 0 || FF_FS_DIRINDEX > 16
+#error Wrong FF_FS_DIRINDEX setting
+#endif
+
+
+/* Path cache */
+#if FF_FS_DCACHE < 0 || FF_FS_DCACHE > 64
+#error Wrong FF_FS_DCACHE setting
+#endif
+
+
+/* Last cluster cache */
+#if FF_FS_FCACHE < 0 || FF_FS_FCACHE > 64
+#error Wrong FF_FS_FCACHE setting
+#endif
+
+
+/* Start cluster to identify a directory in the name index and path cache (root directory is 0) */
+#define DIR_KEY(fs, cl)	(((fs)->fs_type == FS_FAT32 && (cl) == (fs)->dirbase) ? 0 : (cl))
+
+
+/* Free cluster bitmap */
+#if FF_FS_FREEMAP
+#define FREEMAP_PUT(fs, clst, val)	do { if ((fs)->freemap) { if (val) (fs)->freemap[(clst) / 32] |= (DWORD)1 << (clst) % 32; else (fs)->freemap[(clst) / 32] &= ~((DWORD)1 << (clst) % 32); } } while (0)
+#else
+#define FREEMAP_PUT(fs, clst, val)	do { } while (0)
+#endif
+
+
+/* Deferred update of the 2nd FAT */
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+#define FAT2_DEFER(fs, sect)	((fs)->fat2dirty && ((fs)->fat2dirty[((sect) - (fs)->fatbase) / 8] |= 1 << ((sect) - (fs)->fatbase) % 8))	/* Mark the FAT sector to be reflected later (0:not deferred) */
+#define FAT2_BUF		0x8000	/* Size of the copy buffer (must be >=FF_MAX_SS) */
+#else
+#define FAT2_DEFER(fs, sect)	0
+#endif
+
+
+/* Instruction set for the bulk FAT scan and directory scan */
+#if FF_FS_FATSCAN || FF_FS_DIRSCAN
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_SIMD	2	/* AVX2 */
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCAN_SIMD	1	/* SSE2 */
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#define SCAN_SIMD	3	/* AArch64 NEON */
+#else
+#define SCAN_SIMD	0	/* Portable code */
+#endif
+#define FATSCAN_BUF		0x8000	/* Size of the read buffer (must be >=FF_MAX_SS) */
+#define DIRSCAN_BLK		512		/* Size of the block of directory entries tested at a time */
+#endif
+
+
 /* Timestamp */
 #if FF_FS_NORTC == 1
 #if FF_NORTC_YEAR < 1980 || FF_NORTC_YEAR > 2107 || FF_NORTC_MON < 1 || FF_NORTC_MON > 12 || FF_NORTC_MDAY < 1 || FF_NORTC_MDAY > 31
@@ -286,7 +397,7 @@ typedef struct {	/* Open object identifier with status */
 	FATFS* fs;		/*  Object ID 1, volume (NULL:blank entry) */
 	DWORD clu;		/*  Object ID 2, containing directory (0:root) */
 	DWORD ofs;		/*  Object ID 3, offset in the directory */
-	UINT ctr;		/*  Object open status, 0:none, 0x01..0xFF:read mode open count, 0x100:write mode */
+	UINT ctr;		/*  Object open status, 0x01..0xFF:read mode open count, 0x100:write mode (blank entry: 0:never used, 1:released) */
 } FILESEM;
 #endif
 
@@ -469,7 +580,8 @@ static BYTE CurrVol;				/* Current drive number set by f_chdrive() */
 #endif
 
 #if FF_FS_LOCK
-static FILESEM Files[FF_FS_LOCK];	/* Open object lock semaphores */
+static FILESEM Files[FF_FS_LOCK];	/* Open object lock semaphores (hash table with linear probing) */
+static UINT FilesCnt;				/* Number of entries in use in Files[] */
 #if FF_FS_REENTRANT
 static volatile BYTE SysLock;		/* System lock flag to protect Files[] (0:no mutex, 1:unlocked, 2:locked) */
 static volatile BYTE SysLockVolume;	/* Volume id who is locking Files[] */
@@ -934,14 +1046,25 @@ static void unlock_volume (
 	FRESULT res		/* Result code to be returned */
 )
 {
+#if FF_FS_REENTRANT == 2
+	UINT lid;
+#endif
+
+
 	if (fs && res != FR_NOT_ENABLED && res != FR_INVALID_DRIVE && res != FR_TIMEOUT) {
 #if FF_FS_LOCK
 		if (SysLock == 2 && SysLockVolume == fs->ldrv) {	/* Unlock system if it has been locked by this task */
 			SysLock = 1;
 			ff_mutex_give(FF_VOLUMES);
 		}
+#endif
+#if FF_FS_REENTRANT == 2
+		lid = fs->olock; fs->olock = 0;	/* Object lock taken in validate() */
 #endif
 		ff_mutex_give(fs->ldrv);	/* Unlock the volume */
+#if FF_FS_REENTRANT == 2
+		if (lid) ff_mutex_give(FF_VOLUMES + lid);	/* Unlock the object */
+#endif
 	}
 }
 
@@ -954,26 +1077,63 @@ static void unlock_volume (
 /* File sharing control functions                                       */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT chk_share (	/* Check if the file can be accessed */
-	DIR* dp,		/* Directory object pointing the file to be checked */
-	int acc			/* Desired access type (0:Read mode open, 1:Write mode open, 2:Delete or rename) */
+static UINT find_share (	/* Returns index of the object in Files[] (FF_FS_LOCK:not found) */
+	DIR* dp,		/* Directory object pointing the file to find */
+	UINT* be		/* Returns index of the blank entry to register the object (FF_FS_LOCK:table full) */
 )
 {
-	UINT i, be;
+	UINT i, n;
 
-	/* Search open object table for the object */
-	be = 0;
-	for (i = 0; i < FF_FS_LOCK; i++) {
+
+	i = (UINT)((dp->obj.sclust * 0x9E3779B1 ^ dp->dptr ^ (DWORD)dp->obj.fs->id << 16) % FF_FS_LOCK);	/* Hash of the object ID */
+	*be = FF_FS_LOCK;
+	for (n = 0; n < FF_FS_LOCK; n++) {	/* Probe the entries from the hashed index */
 		if (Files[i].fs) {	/* Existing entry */
 			if (Files[i].fs == dp->obj.fs &&	 	/* Check if the object matches with an open object */
 				Files[i].clu == dp->obj.sclust &&
-				Files[i].ofs == dp->dptr) break;
+				Files[i].ofs == dp->dptr) return i;
 		} else {			/* Blank entry */
-			be = 1;
+			if (*be == FF_FS_LOCK) *be = i;
+			if (Files[i].ctr == 0) break;	/* The object is not in the table if the entry has never been used */
 		}
+		if (++i == FF_FS_LOCK) i = 0;
+	}
+	return FF_FS_LOCK;
+}
+
+
+static void free_share (	/* Release an entry of Files[] */
+	UINT i			/* Index of the entry */
+)
+{
+	UINT n = (i + 1) % FF_FS_LOCK;
+
+
+	Files[i].fs = 0;	/* Free the entry <<<If this memory write operation is not in atomic, FF_FS_REENTRANT == 1 and FF_VOLUMES > 1, there is a potential error in this process >>> */
+	FilesCnt--;
+	if (Files[n].fs || Files[n].ctr) {	/* Leave it released if the probe sequence can go beyond it */
+		Files[i].ctr = 1;
+		return;
 	}
+	do {		/* Else turn it and preceding released entries into never used */
+		Files[i].ctr = 0;
+		i = (i + FF_FS_LOCK - 1) % FF_FS_LOCK;
+	} while (!Files[i].fs && Files[i].ctr);
+}
+
+
+static FRESULT chk_share (	/* Check if the file can be accessed */
+	DIR* dp,		/* Directory object pointing the file to be checked */
+	int acc			/* Desired access type (0:Read mode open, 1:Write mode open, 2:Delete or rename) */
+)
+{
+	UINT i, be;
+
+
+	/* Search open object table for the object */
+	i = find_share(dp, &be);
 	if (i == FF_FS_LOCK) {	/* The object has not been opened */
-		return (!be && acc != 2) ? FR_TOO_MANY_OPEN_FILES : FR_OK;	/* Is there a blank entry for new object? */
+		return (be == FF_FS_LOCK && acc != 2) ? FR_TOO_MANY_OPEN_FILES : FR_OK;	/* Is there a blank entry for new object? */
 	}
 
 	/* The object was opened. Reject any open against writing file and all write mode open */
@@ -983,10 +1143,7 @@ static FRESULT chk_share (	/* Check if the file can be accessed */
 
 static int enq_share (void)	/* Check if an entry is available for a new object */
 {
-	UINT i;
-
-	for (i = 0; i < FF_FS_LOCK && Files[i].fs; i++) ;	/* Find a free entry */
-	return (i == FF_FS_LOCK) ? 0 : 1;
+	return (FilesCnt < FF_FS_LOCK) ? 1 : 0;
 }
 
 
@@ -995,22 +1152,19 @@ static UINT inc_share (	/* Increment object open counter and returns its index (
 	int acc		/* Desired access (0:Read, 1:Write, 2:Delete/Rename) */
 )
 {
-	UINT i;
+	UINT i, be;
 
 
-	for (i = 0; i < FF_FS_LOCK; i++) {	/* Find the object */
-		if (Files[i].fs == dp->obj.fs
-		 && Files[i].clu == dp->obj.sclust
-		 && Files[i].ofs == dp->dptr) break;
-	}
+	i = find_share(dp, &be);		/* Find the object */
 
 	if (i == FF_FS_LOCK) {			/* Not opened. Register it as new. */
-		for (i = 0; i < FF_FS_LOCK && Files[i].fs; i++) ;	/* Find a free entry */
-		if (i == FF_FS_LOCK) return 0;	/* No free entry to register (int err) */
+		if (be == FF_FS_LOCK) return 0;	/* No free entry to register (int err) */
+		i = be;
 		Files[i].fs = dp->obj.fs;
 		Files[i].clu = dp->obj.sclust;
 		Files[i].ofs = dp->dptr;
 		Files[i].ctr = 0;
+		FilesCnt++;
 	}
 
 	if (acc >= 1 && Files[i].ctr) return 0;	/* Access violation (int err) */
@@ -1035,7 +1189,7 @@ static FRESULT dec_share (	/* Decrement object open counter */
 		if (n > 0) n--;			/* Decrement read mode open count */
 		Files[i].ctr = n;
 		if (n == 0) {			/* Delete the object semaphore if open count becomes zero */
-			Files[i].fs = 0;	/* Free the entry <<<If this memory write operation is not in atomic, FF_FS_REENTRANT == 1 and FF_VOLUMES > 1, there is a potential error in this process >>> */
+			free_share(i);
 		}
 		res = FR_OK;
 	} else {
@@ -1052,7 +1206,7 @@ static void clear_share (	/* Clear all lock entries of the volume */
 	UINT i;
 
 	for (i = 0; i < FF_FS_LOCK; i++) {
-		if (Files[i].fs == fs) Files[i].fs = 0;
+		if (Files[i].fs == fs) free_share(i);
 	}
 }
 
@@ -1064,6 +1218,41 @@ static void clear_share (	/* Clear all lock entries of the volume */
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
 #if !FF_FS_READONLY
+#if FF_WIN_CACHE
+static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i, pass;
+	BYTE *buf, *flag;
+	LBA_t sect;
+
+
+	/* Write back the dirty sectors in the window and cache slots in ascending LBA order,
+	   then reflect the FAT sectors to the 2nd FAT in the second pass (b1 of the flag) */
+	for (pass = 1; pass <= 2; pass++) {
+		for (;;) {
+			flag = (fs->wflag & pass) ? &fs->wflag : 0;
+			buf = fs->win; sect = fs->winsect;
+			for (i = 0; i < FF_WIN_CACHE; i++) {	/* Find the lowest sector to be written in this pass */
+				if ((fs->wcflag[i] & pass) && (!flag || fs->wcsect[i] < sect)) {
+					flag = &fs->wcflag[i]; buf = fs->wcbuf[i]; sect = fs->wcsect[i];
+				}
+			}
+			if (!flag) break;
+			if (pass == 1) {
+				if (disk_write(fs->pdrv, buf, sect, 1) != RES_OK) return FR_DISK_ERR;
+				*flag = (fs->n_fats == 2 && sect - fs->fatbase < fs->fsize && !FAT2_DEFER(fs, sect)) ? 2 : 0;	/* Is it in the 1st FAT to be reflected now? */
+			} else {
+				disk_write(fs->pdrv, buf, sect + fs->fsize, 1);	/* Reflect it to 2nd FAT */
+				*flag = 0;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+#else
 static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs			/* Filesystem object */
 )
@@ -1075,7 +1264,7 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
 			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
-				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+				if (fs->n_fats == 2 && !FAT2_DEFER(fs, fs->winsect)) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
 			}
 		} else {
 			res = FR_DISK_ERR;
@@ -1084,8 +1273,75 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	return res;
 }
 #endif
+#endif
+
+
+#if FF_WIN_CACHE
+#if !FF_FS_READONLY
+static void wc_discard (	/* Drop cached copies of sectors written without the window */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect,		/* Start sector */
+	LBA_t n			/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE; i++) {
+		if (fs->wcuse[i] && fs->wcsect[i] - sect < n) {
+			fs->wcuse[i] = 0; fs->wcflag[i] = 0;	/* Make the slot empty */
+		}
+	}
+}
+#endif
+
+
+static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector LBA to make appearance in the fs->win[] */
+)
+{
+	FRESULT res = FR_OK;
+	UINT i, n;
+	BYTE t, *p1, *p2;
+	LBA_t s;
+
 
+	if (sect != fs->winsect) {	/* Window offset changed? */
+		for (i = 0; i < FF_WIN_CACHE && (!fs->wcuse[i] || fs->wcsect[i] != sect); i++) ;	/* Is the sector in the cache? */
+		if (i < FF_WIN_CACHE) {		/* Cache hit: swap the window and the slot */
+			for (p1 = fs->win, p2 = fs->wcbuf[i], n = SS(fs); n; n--, p1++, p2++) {
+				t = *p1; *p1 = *p2; *p2 = t;
+			}
+			t = fs->wflag; fs->wflag = fs->wcflag[i]; fs->wcflag[i] = t;
+			s = fs->winsect; fs->winsect = sect; fs->wcsect[i] = s;
+		} else {					/* Cache miss: move the window into the least recently used slot */
+			for (i = 0, n = 1; n < FF_WIN_CACHE; n++) {
+				if (fs->wcuse[n] < fs->wcuse[i]) i = n;	/* (An empty slot has the lowest value) */
+			}
+#if !FF_FS_READONLY
+			if (fs->wcuse[i] && fs->wcflag[i]) {	/* Write back the victim if dirty */
+				if (disk_write(fs->pdrv, fs->wcbuf[i], fs->wcsect[i], 1) != RES_OK) return FR_DISK_ERR;
+				if (fs->n_fats == 2 && fs->wcsect[i] - fs->fatbase < fs->fsize && !FAT2_DEFER(fs, fs->wcsect[i])) {	/* Reflect it to 2nd FAT if needed */
+					disk_write(fs->pdrv, fs->wcbuf[i], fs->wcsect[i] + fs->fsize, 1);
+				}
+			}
+#endif
+			memcpy(fs->wcbuf[i], fs->win, SS(fs));
+			fs->wcsect[i] = fs->winsect; fs->wcflag[i] = fs->wflag;
+			fs->wflag = 0;
+			if (disk_read(fs->pdrv, fs->win, sect, 1) != RES_OK) {
+				sect = (LBA_t)0 - 1;	/* Invalidate window if read data is not valid */
+				res = FR_DISK_ERR;
+			}
+			fs->winsect = sect;
+		}
+		fs->wcuse[i] = (fs->wcsect[i] != (LBA_t)0 - 1) ? ++fs->wctick : 0;	/* Stamp the slot (empty if it got an invalid window) */
+	}
+	return res;
+}
 
+#else
 static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs,		/* Filesystem object */
 	LBA_t sect		/* Sector LBA to make appearance in the fs->win[] */
@@ -1108,7 +1364,139 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	}
 	return res;
 }
+#endif
+
+
+
+
+#if FF_FS_FATRAM
+/*-----------------------------------------------------------------------*/
+/* Load/Flush the in-memory copy of the FAT                              */
+/*-----------------------------------------------------------------------*/
+
+#define FATRAM_DIRTY(fs, ofs)	((fs)->fatdirty[(ofs) / SS(fs) / 8] |= 1 << ((ofs) / SS(fs) % 8))	/* Mark the FAT sector of the byte offset modified */
+
+static void load_fatram (	/* fs->fatram is left null if the FAT is not loaded */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD sz;
+
+
+	if (fs->fsize > FF_FS_FATRAM * 1024UL / SS(fs)) return;	/* Larger than the limit: go on with the window */
+	sz = fs->fsize * SS(fs);
+	fs->fatram = ff_memalloc((UINT)(sz + (fs->fsize + 7) / 8));
+	if (!fs->fatram) return;		/* Not enough core: go on with the window */
+	fs->fatdirty = fs->fatram + sz;
+	memset(fs->fatdirty, 0, (fs->fsize + 7) / 8);
+	if (disk_read(fs->pdrv, fs->fatram, fs->fatbase, (UINT)fs->fsize) != RES_OK) {	/* Load the 1st FAT in a multi-sector read */
+		ff_memfree(fs->fatram);		/* Go on with the window, which reports the error if it persists */
+		fs->fatram = 0;
+	}
+}
+
+
+#if !FF_FS_READONLY
+static FRESULT sync_fatram (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD s, e;
+	UINT i;
+
+
+	if (!fs->fatram) return FR_OK;
+	for (i = 0; i < fs->n_fats; i++) {	/* Write back the 1st FAT, and then reflect it to the 2nd FAT */
+		for (s = 0; s < fs->fsize; s = e) {
+			if (fs->fatdirty[s / 8] == 0) {	/* Skip 8 clean sectors at a time */
+				e = (s | 7) + 1;
+				continue;
+			}
+			if (!(fs->fatdirty[s / 8] & 1 << s % 8)) {
+				e = s + 1;
+				continue;
+			}
+			for (e = s + 1; e < fs->fsize && (fs->fatdirty[e / 8] & 1 << e % 8); e++) ;	/* Find the end of the dirty run */
+			if (disk_write(fs->pdrv, fs->fatram + s * SS(fs), fs->fatbase + i * fs->fsize + s, (UINT)(e - s)) != RES_OK && i == 0) {
+				return FR_DISK_ERR;
+			}
+		}
+	}
+	memset(fs->fatdirty, 0, (fs->fsize + 7) / 8);
+	return FR_OK;
+}
+#endif
+#endif
+
+
+
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Reflect the deferred FAT sectors to the 2nd FAT                       */
+/*-----------------------------------------------------------------------*/
+
+static const BYTE* fat2_src (	/* Pointer to the clean copy of the sector in the memory (null:not in the memory) */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector to find */
+)
+{
+#if FF_WIN_CACHE
+	UINT i;
+
+	for (i = 0; i < FF_WIN_CACHE; i++) {
+		if (fs->wcuse[i] && fs->wcsect[i] == sect) return fs->wcbuf[i];
+	}
+#endif
+	return (fs->winsect == sect) ? fs->win : 0;
+}
+
+
+static void sync_fat2 (
+	FATFS* fs		/* Filesystem object (the window has been flushed) */
+)
+{
+	DWORD s, e, n, i;
+	UINT szb = 0;
+	BYTE *buf = 0;
+	const BYTE *src;
+
 
+	if (!fs->fat2dirty) return;
+	for (s = 0; s < fs->fsize; s = e) {
+		if (fs->fat2dirty[s / 8] == 0) {	/* Skip 8 clean sectors at a time */
+			e = (s | 7) + 1;
+			continue;
+		}
+		if (!(fs->fat2dirty[s / 8] & 1 << s % 8)) {
+			e = s + 1;
+			continue;
+		}
+		for (e = s + 1; e < fs->fsize && (fs->fat2dirty[e / 8] & 1 << e % 8); e++) ;	/* Find the end of the marked run */
+		if (!buf) {		/* Get a copy buffer at the first run */
+			for (szb = FAT2_BUF; szb > SS(fs) && (buf = ff_memalloc(szb)) == 0; szb /= 2) ;
+			if (!buf) {	/* Borrow the window if not enough core */
+				buf = fs->win; szb = SS(fs);
+				fs->winsect = (LBA_t)0 - 1;
+			}
+		}
+		for ( ; s < e; s += n) {	/* Copy the run from the 1st FAT to the 2nd FAT */
+			n = (e - s < szb / SS(fs)) ? e - s : szb / SS(fs);
+			for (i = 0; i < n && fat2_src(fs, fs->fatbase + s + i); i++) ;
+			if (i == n) {	/* Take the sectors from the window and cache if all of them are there */
+				for (i = 0; i < n; i++) {
+					src = fat2_src(fs, fs->fatbase + s + i);
+					if (src != buf + i * SS(fs)) memcpy(buf + i * SS(fs), src, SS(fs));
+				}
+			} else {
+				if (disk_read(fs->pdrv, buf, fs->fatbase + s, (UINT)n) != RES_OK) break;	/* Leave the rest of run marked on error */
+			}
+			disk_write(fs->pdrv, buf, fs->fatbase + fs->fsize + s, (UINT)n);
+			for (i = s; i < s + n; i++) fs->fat2dirty[i / 8] &= ~(1 << i % 8);
+		}
+	}
+	if (buf != fs->win) ff_memfree(buf);
+}
+#endif
 
 
 
@@ -1124,7 +1512,15 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 	FRESULT res;
 
 
+#if FF_FS_FATRAM
+	res = sync_fatram(fs);
+	if (res == FR_OK) res = sync_window(fs);
+#else
 	res = sync_window(fs);
+#endif
+#if FF_FS_LAZYFAT2
+	if (res == FR_OK) sync_fat2(fs);	/* Reflect the deferred FAT sectors */
+#endif
 	if (res == FR_OK) {
 		if (fs->fsi_flag == 1) {	/* Allocation changed? */
 			fs->fsi_flag = 0;
@@ -1137,9 +1533,15 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 				st_32(fs->win + FSI_Nxt_Free, fs->last_clst);	/* Last allocated culuster */
 				st_32(fs->win + FSI_TrailSig, 0xAA550000);		/* Trailing signature */
 				disk_write(fs->pdrv, fs->win, fs->winsect = fs->volbase + 1, 1);	/* Write it into the FSInfo sector (Next to VBR) */
+#if FF_WIN_CACHE
+				wc_discard(fs, fs->winsect, 1);
+#endif
 			}
 #if FF_FS_EXFAT
 			else if (fs->fs_type == FS_EXFAT) {	/* exFAT: Update PercInUse field in BPB */
+#if FF_WIN_CACHE
+				wc_discard(fs, fs->volbase, 1);
+#endif
 				if (disk_read(fs->pdrv, fs->win, fs->winsect = fs->volbase, 1) == RES_OK) {	/* Load VBR */
 					BYTE perc_inuse = (fs->free_clst <= fs->n_fatent - 2) ? (BYTE)((QWORD)(fs->n_fatent - 2 - fs->free_clst) * 100 / (fs->n_fatent - 2)) : 0xFF;	/* Precent in use 0-100 or 0xFF(unknown) */
 
@@ -1199,6 +1601,20 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 	} else {
 		val = 0xFFFFFFFF;	/* Default value falls on disk error */
 
+#if FF_FS_FATRAM
+		if (fs->fatram) {	/* Is the FAT in the memory? */
+			switch (fs->fs_type) {
+			case FS_FAT12 :
+				bc = (UINT)clst; bc += bc / 2;
+				wc = ld_16(fs->fatram + bc);
+				return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
+			case FS_FAT16 :
+				return ld_16(fs->fatram + clst * 2);
+			default :
+				return ld_32(fs->fatram + clst * 4) & 0x0FFFFFFF;
+			}
+		}
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
@@ -1273,6 +1689,31 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if FF_FS_FATRAM
+		if (fs->fatram) {	/* Is the FAT in the memory? */
+			switch (fs->fs_type) {
+			case FS_FAT12:
+				bc = (UINT)clst; bc += bc / 2;
+				p = fs->fatram + bc;
+				*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;	/* Update 1st byte */
+				FATRAM_DIRTY(fs, bc);
+				p++; bc++;
+				*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));	/* Update 2nd byte */
+				FATRAM_DIRTY(fs, bc);
+				break;
+			case FS_FAT16:
+				st_16(fs->fatram + clst * 2, (WORD)val);
+				FATRAM_DIRTY(fs, clst * 2);
+				break;
+			default:
+				p = fs->fatram + clst * 4;
+				st_32(p, (val & 0x0FFFFFFF) | (ld_32(p) & 0xF0000000));
+				FATRAM_DIRTY(fs, clst * 4);
+			}
+			FREEMAP_PUT(fs, clst, val);
+			return FR_OK;
+		}
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12:
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
@@ -1308,6 +1749,7 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 		}
+		if (res == FR_OK) FREEMAP_PUT(fs, clst, val);
 	}
 	return res;
 }
@@ -1317,45 +1759,283 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
-#if FF_FS_EXFAT && !FF_FS_READONLY
+#if FF_FS_FATSCAN && (FF_FS_FREEMAP || (FF_FS_MINIMIZE == 0 && !FF_FS_READONLY))
 /*-----------------------------------------------------------------------*/
-/* exFAT: Accessing FAT and Allocation Bitmap                            */
+/* FAT16/32: Bulk scan of the FAT                                        */
 /*-----------------------------------------------------------------------*/
 
-/*--------------------------------------*/
-/* Find a contiguous free cluster block */
-/*--------------------------------------*/
-
-static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:Disk error */
-	FATFS* fs,	/* Filesystem object */
-	DWORD clst,	/* Cluster number to scan from */
-	DWORD ncl	/* Number of contiguous clusters to find (1..) */
+static DWORD free_entries (	/* Bit map of free entries (bit 0 is the first entry) */
+	const BYTE* p,	/* Top of 32 FAT entries */
+	int fat32		/* 0:FAT16, 1:FAT32 */
 )
 {
-	BYTE bm, bv;
+	DWORD m = 0;
 	UINT i;
-	DWORD val, scl, ctr;
 
 
-	clst -= 2;	/* The first bit in the bitmap corresponds to cluster #2 */
-	if (clst >= fs->n_fatent - 2) clst = 0;
-	scl = val = clst; ctr = 0;
-	for (;;) {
-		if (move_window(fs, fs->bitbase + val / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
-		i = val / 8 % SS(fs); bm = 1 << (val % 8);
-		do {
-			do {
-				bv = fs->win[i] & bm; bm <<= 1;		/* Get bit value */
-				if (++val >= fs->n_fatent - 2) {	/* Next cluster (with wrap-around) */
-					val = 0; bm = 0; i = SS(fs);
-				}
-				if (bv == 0) {	/* Is it a free cluster? */
-					if (++ctr == ncl) return scl + 2;	/* Check if run length is sufficient for required */
-				} else {
-					scl = val; ctr = 0;		/* Encountered a cluster in-use, restart to scan */
-				}
-				if (val == clst) return 0;	/* All cluster scanned? */
-			} while (bm != 0);
+#if SCAN_SIMD == 2	/* AVX2: 8 FAT32 or 16 FAT16 entries in a compare */
+	const __m256i z = _mm256_setzero_si256();
+
+	if (fat32) {
+		const __m256i mk = _mm256_set1_epi32(0x0FFFFFFF);
+
+		for (i = 0; i < 4; i++) {
+			__m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(p + i * 32)), mk);
+			m |= (DWORD)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, z))) << i * 8;
+		}
+	} else {
+		__m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)p), z);
+		__m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(p + 32)), z);
+
+		m = (DWORD)_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8));	/* Packing works within 128-bit lanes */
+	}
+
+#elif SCAN_SIMD == 1	/* SSE2: 4 FAT32 or 8 FAT16 entries in a compare */
+	const __m128i z = _mm_setzero_si128();
+
+	if (fat32) {
+		const __m128i mk = _mm_set1_epi32(0x0FFFFFFF);
+
+		for (i = 0; i < 8; i++) {
+			__m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + i * 16)), mk);
+			m |= (DWORD)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, z))) << i * 4;
+		}
+	} else {
+		for (i = 0; i < 2; i++) {
+			__m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(p + i * 32)), z);
+			__m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(p + i * 32 + 16)), z);
+			m |= (DWORD)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << i * 16;
+		}
+	}
+
+#elif SCAN_SIMD == 3	/* NEON: 4 FAT32 or 8 FAT16 entries in a compare, weighted sum as the bit map */
+	if (fat32) {
+		static const uint32_t w32[4] = {1, 2, 4, 8};
+		const uint32x4_t mk = vdupq_n_u32(0x0FFFFFFF), w = vld1q_u32(w32);
+
+		for (i = 0; i < 8; i++) {
+			uint32x4_t e = vceqq_u32(vandq_u32(vreinterpretq_u32_u8(vld1q_u8(p + i * 16)), mk), vdupq_n_u32(0));
+			m |= (DWORD)vaddvq_u32(vandq_u32(e, w)) << i * 4;
+		}
+	} else {
+		static const uint16_t w16[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+		const uint16x8_t w = vld1q_u16(w16);
+
+		for (i = 0; i < 4; i++) {
+			uint16x8_t e = vceqq_u16(vreinterpretq_u16_u8(vld1q_u8(p + i * 16)), vdupq_n_u16(0));
+			m |= (DWORD)vaddvq_u16(vandq_u16(e, w)) << i * 8;
+		}
+	}
+
+#else					/* Portable code */
+	for (i = 0; i < 32; i++) {
+		if (fat32 ? (ld_32(p + i * 4) & 0x0FFFFFFF) == 0 : ld_16(p + i * 2) == 0) m |= (DWORD)1 << i;
+	}
+#endif
+	return m;
+}
+
+
+static FRESULT scan_fat (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object (FAT16/32) */
+	DWORD* nfree,	/* Pointer to return the number of free clusters */
+	DWORD* map		/* Cluster usage bitmap to be filled in (null:not needed) */
+)
+{
+	int fat32 = (fs->fs_type == FS_FAT32);
+	UINT gsz = fat32 ? 128 : 64;			/* Bytes of a group of 32 entries */
+	UINT gps = SS(fs) / gsz;				/* Groups per sector */
+	DWORD grp, ngrp = (fs->n_fatent + 31) / 32, m, nf = 0;
+	DWORD nsect = (ngrp + gps - 1) / gps;	/* FAT sectors to scan */
+	DWORD sect, szb = 0, n;
+	BYTE *buf, *ibuf = 0;
+	UINT i;
+
+
+#if FF_FS_FATRAM
+	if (!fs->fatram)
+#endif
+	{
+#if !FF_FS_READONLY
+		if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Modified FAT sectors are to be on the disk */
+#endif
+		/* Allocate a temporary buffer for multi-sector reads */
+		for (szb = (nsect * SS(fs) >= FATSCAN_BUF) ? FATSCAN_BUF : nsect * SS(fs); szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
+	}
+	for (grp = sect = 0; sect < nsect; sect += n) {
+#if FF_FS_FATRAM
+		if (fs->fatram) {	/* The FAT is in the memory */
+			buf = fs->fatram; n = nsect;
+		} else
+#endif
+		if (ibuf) {			/* Read some sectors at a time */
+			n = szb / SS(fs);
+			if (n > nsect - sect) n = nsect - sect;
+			if (disk_read(fs->pdrv, ibuf, fs->fatbase + sect, (UINT)n) != RES_OK) break;
+			buf = ibuf;
+		} else {			/* Read a sector at a time via the window */
+			if (move_window(fs, fs->fatbase + sect) != FR_OK) break;
+			buf = fs->win; n = 1;
+		}
+		for (i = 0; i < n * gps && grp < ngrp; i++, grp++) {
+			m = free_entries(buf + i * gsz, fat32);
+			if (grp == 0) m &= ~(DWORD)3;		/* Cluster 0 and 1 are not clusters */
+			if (grp == ngrp - 1 && fs->n_fatent % 32) m &= ((DWORD)1 << fs->n_fatent % 32) - 1;	/* Entries out of the volume */
+			if (map) map[grp] = ~m;
+			m = m - ((m >> 1) & 0x55555555);	/* Count the free entries */
+			m = (m & 0x33333333) + ((m >> 2) & 0x33333333);
+			nf += (((m + (m >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+		}
+	}
+	if (ibuf) ff_memfree(ibuf);
+	if (sect < nsect) return FR_DISK_ERR;
+	*nfree = nf;
+	return FR_OK;
+}
+
+#endif /* FF_FS_FATSCAN */
+
+
+
+
+#if FF_FS_FREEMAP
+/*-----------------------------------------------------------------------*/
+/* FAT12/16/32: Free cluster bitmap                                      */
+/*-----------------------------------------------------------------------*/
+
+static void build_freemap (	/* fs->freemap is left null if the map is not built */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD clst, stat, nfree = 0;
+	UINT nw = (UINT)((fs->n_fatent + 31) / 32);
+	FFOBJID obj;
+
+
+	fs->freemap = ff_memalloc(nw * 4);
+	if (!fs->freemap) return;			/* Not enough core: go on without the map */
+	memset(fs->freemap, 0xFF, nw * 4);	/* Reserved clusters and the tail of the map are 'in use' */
+#if FF_FS_FATSCAN
+	if (fs->fs_type != FS_FAT12) {	/* FAT16/32: Fill in the map with the bulk scan */
+		if (scan_fat(fs, &nfree, fs->freemap) != FR_OK) clst = 0xFFFFFFFF;	/* Disk error */
+		else clst = fs->n_fatent;
+	} else
+#endif
+	clst = 2;
+	obj.fs = fs;
+	for ( ; clst < fs->n_fatent; clst++) {	/* Read the status of all clusters (a broken entry is left 'in use') */
+		stat = get_fat(&obj, clst);
+		if (stat == 0xFFFFFFFF) break;
+		if (stat == 0) {
+			fs->freemap[clst / 32] &= ~((DWORD)1 << clst % 32);
+			nfree++;
+		}
+	}
+	if (clst != fs->n_fatent) {	/* Disk error: go on without the map, the FAT is read when needed */
+		ff_memfree(fs->freemap);
+		fs->freemap = 0;
+		return;
+	}
+#if !FF_FS_READONLY
+	fs->free_clst = nfree;	/* The free cluster count is exact now */
+#endif
+}
+
+
+#if !FF_FS_READONLY
+static DWORD scan_freemap (	/* First cluster in the range with the status, end if not found */
+	const DWORD* map,	/* Cluster usage bitmap */
+	DWORD clst,			/* Start of the range */
+	DWORD end,			/* End of the range (not included) */
+	int used			/* Status to find (0:free, 1:in use) */
+)
+{
+	DWORD w;
+
+
+	while (clst < end) {
+		w = (used ? map[clst / 32] : ~map[clst / 32]) >> clst % 32;	/* Bits with the status from clst */
+		if (w) {	/* Found in this word? */
+			while (!(w & 1)) {
+				w >>= 1; clst++;
+			}
+			return (clst < end) ? clst : end;
+		}
+		clst = (clst | 31) + 1;		/* Skip to the next word */
+	}
+	return end;
+}
+
+
+static DWORD find_freemap (	/* 0:Not found, 2..:Top of the free block */
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Cluster to start to find (wraps around to cluster 2) */
+	DWORD ncl		/* Number of contiguous free clusters to find */
+)
+{
+	DWORD end, val, top;
+	UINT pass;
+
+
+	if (clst < 2 || clst > fs->n_fatent) clst = 2;
+	for (pass = 0; pass < 2; pass++) {	/* Search clst..end, and then 2..clst */
+		end = (pass == 0) ? fs->n_fatent : clst;
+		val = (pass == 0) ? clst : 2;
+		for (;;) {
+			top = scan_freemap(fs->freemap, val, end, 0);		/* Top of the next free block */
+			if (top >= end || end - top < ncl) break;
+			val = scan_freemap(fs->freemap, top, top + ncl, 1);	/* Is it long enough? */
+			if (val == top + ncl) return top;
+		}
+	}
+	return 0;
+}
+#endif
+
+#endif /* FF_FS_FREEMAP */
+
+
+
+
+#if FF_FS_EXFAT && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* exFAT: Accessing FAT and Allocation Bitmap                            */
+/*-----------------------------------------------------------------------*/
+
+/*--------------------------------------*/
+/* Find a contiguous free cluster block */
+/*--------------------------------------*/
+
+static DWORD find_bitmap (	/* 0:Not found, 2..:Cluster block found, 0xFFFFFFFF:Disk error */
+	FATFS* fs,	/* Filesystem object */
+	DWORD clst,	/* Cluster number to scan from */
+	DWORD ncl	/* Number of contiguous clusters to find (1..) */
+)
+{
+	BYTE bm, bv;
+	UINT i;
+	DWORD val, scl, ctr;
+
+
+	clst -= 2;	/* The first bit in the bitmap corresponds to cluster #2 */
+	if (clst >= fs->n_fatent - 2) clst = 0;
+	scl = val = clst; ctr = 0;
+	for (;;) {
+		if (move_window(fs, fs->bitbase + val / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
+		i = val / 8 % SS(fs); bm = 1 << (val % 8);
+		do {
+			do {
+				bv = fs->win[i] & bm; bm <<= 1;		/* Get bit value */
+				if (++val >= fs->n_fatent - 2) {	/* Next cluster (with wrap-around) */
+					val = 0; bm = 0; i = SS(fs);
+				}
+				if (bv == 0) {	/* Is it a free cluster? */
+					if (++ctr == ncl) return scl + 2;	/* Check if run length is sufficient for required */
+				} else {
+					scl = val; ctr = 0;		/* Encountered a cluster in-use, restart to scan */
+				}
+				if (val == clst) return 0;	/* All cluster scanned? */
+			} while (bm != 0);
 			bm = 1;
 		} while (++i < SS(fs));
 	}
@@ -1446,6 +2126,72 @@ static FRESULT fill_last_frag (
 
 
 
+#if FF_FS_FCACHE && !FF_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Last cluster cache                                     */
+/*-----------------------------------------------------------------------*/
+
+static DWORD fc_find (	/* Last cluster of the file (0:not in the cache) */
+	FATFS* fs,			/* Filesystem object */
+	DWORD sclust,		/* Start cluster of the file in the directory entry */
+	FSIZE_t objsize		/* Size of the file in the directory entry */
+)
+{
+	FFFCENT *e;
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_FCACHE; i++) {
+		e = &fs->fcent[i];
+		if (e->use && e->sclust == sclust && e->objsize == objsize) {	/* Does the entry still match the directory entry? */
+			e->use = ++fs->fctick;
+			return e->lclust;
+		}
+	}
+	return 0;
+}
+
+
+static void fc_put (
+	FIL* fp			/* File object at the end of the file */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	FFFCENT *e;
+	UINT i;
+
+
+	e = &fs->fcent[0];
+	for (i = 0; i < FF_FS_FCACHE; i++) {	/* Take the entry of the file or else the least recently used one */
+		if (fs->fcent[i].use && fs->fcent[i].sclust == fp->obj.sclust) {
+			e = &fs->fcent[i]; break;
+		}
+		if (fs->fcent[i].use < e->use) e = &fs->fcent[i];
+	}
+	e->use = ++fs->fctick;
+	e->sclust = fp->obj.sclust;
+	e->objsize = fp->obj.objsize;
+	e->lclust = fp->clust;
+}
+
+
+static void fc_remove (
+	FATFS* fs,		/* Filesystem object */
+	DWORD sclust	/* Start cluster of the file */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_FCACHE; i++) {	/* Discard the entry of the file */
+		if (fs->fcent[i].sclust == sclust) fs->fcent[i].use = 0;
+	}
+}
+
+#endif	/* FF_FS_FCACHE && !FF_FS_READONLY */
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
@@ -1468,6 +2214,9 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 #endif
 
 	if (clst < 2 || clst >= fs->n_fatent) return FR_INT_ERR;	/* Check if in valid range */
+#if FF_FS_FCACHE
+	fc_remove(fs, pclst ? obj->sclust : clst);	/* The last cluster of the file is no longer valid */
+#endif
 
 	/* Mark the previous cluster 'EOC' on the FAT if it exists */
 	if (pclst != 0 && (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT || obj->stat != 2)) {
@@ -1485,6 +2234,9 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
 			if (res != FR_OK) return res;
 		}
+#if FF_WIN_CACHE
+		wc_discard(fs, clst2sect(fs, clst), fs->csize);	/* Drop cached (and possibly dirty) directory sectors of the freed cluster */
+#endif
 		if (fs->free_clst < fs->n_fatent - 2) {	/* Update allocation information if it is valid */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
@@ -1608,6 +2360,12 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 				ncl = 0;
 			}
 		}
+#if FF_FS_FREEMAP
+		if (ncl == 0 && fs->freemap) {	/* Find a free cluster on the bitmap */
+			ncl = find_freemap(fs, scl + 1, 1);
+			if (ncl == 0) return 0;		/* No free cluster found? */
+		}
+#endif
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
 			ncl = scl;	/* Start cluster */
 			for (;;) {
@@ -1641,6 +2399,67 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	return ncl;		/* Return new cluster number or error status */
 }
 
+
+#if FF_FS_BULKALLOC
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch a chain with a contiguous run of clusters      */
+/*-----------------------------------------------------------------------*/
+
+static DWORD stretch_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Next cluster# */
+	FFOBJID* obj,		/* Corresponding object */
+	DWORD clst,			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD ncl,			/* Number of clusters wanted */
+	DWORD* ecl			/* Pointer to return the last cluster# of the contiguous run */
+)
+{
+	DWORD cs, scl, n;
+	FRESULT res = FR_OK;
+	FATFS *fs = obj->fs;
+
+
+	if (clst != 0) {	/* Stretch a chain */
+		cs = get_fat(obj, clst);			/* Check the cluster status */
+		if (cs < 2) return 1;				/* Test for insanity */
+		if (cs == 0xFFFFFFFF) return cs;	/* Test for disk error */
+		if (cs < fs->n_fatent) {			/* It is already followed by next cluster */
+			*ecl = cs;
+			return cs;
+		}
+	}
+	scl = create_chain(obj, clst);			/* Get the top of the run in the same way as a cluster */
+	*ecl = scl;
+	if (scl < 2 || scl == 0xFFFFFFFF || (FF_FS_EXFAT && fs->fs_type == FS_EXFAT)) return scl;
+
+	if (ncl > fs->n_fatent - scl) ncl = fs->n_fatent - scl;	/* Clip the run at end of the FAT */
+#if FF_FS_FREEMAP
+	if (fs->freemap) {	/* Count the free clusters following the top on the bitmap */
+		n = scan_freemap(fs->freemap, scl + 1, scl + ncl, 1) - scl;
+	} else
+#endif
+	{
+		for (n = 1; n < ncl; n++) {		/* Count the free clusters following the top on the FAT */
+			cs = get_fat(obj, scl + n);
+			if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+			if (cs != 0) break;
+		}
+	}
+	if (n > 1) {	/* Link the run in ascending order of the FAT entries */
+		for (cs = scl; cs < scl + n - 1 && res == FR_OK; cs++) {
+			res = put_fat(fs, cs, cs + 1);
+		}
+		if (res == FR_OK) res = put_fat(fs, scl + n - 1, 0xFFFFFFFF);
+		if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+		fs->last_clst = scl + n - 1;	/* Update allocation information */
+		if (fs->free_clst <= fs->n_fatent - 2) {
+			fs->free_clst = (fs->free_clst > n - 1) ? fs->free_clst - (n - 1) : 0;
+			fs->fsi_flag |= 1;
+		}
+		*ecl = scl + n - 1;
+	}
+	return scl;
+}
+
+#endif /* FF_FS_BULKALLOC */
 #endif /* !FF_FS_READONLY */
 
 
@@ -1677,72 +2496,334 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 
 
 
+#if FF_FS_EXTMAP
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Fill a cluster with zeros                        */
+/* FAT handling - Cluster map of file object                             */
 /*-----------------------------------------------------------------------*/
 
-#if !FF_FS_READONLY
-static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
-	FATFS *fs,		/* Filesystem object */
-	DWORD clst		/* Directory table to clear */
+static DWORD xmap_clust (	/* 0:Not in the map, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD cl		/* Cluster order from top of the file */
 )
 {
-	LBA_t sect;
-	UINT n, szb;
-	BYTE *ibuf;
+	UINT lo, hi, mid;
 
 
-	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
-	sect = clst2sect(fs, clst);		/* Top of the cluster */
-	fs->winsect = sect;				/* Set window to top of the cluster */
-	memset(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
-#if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
-	/* Allocate a temporary buffer */
-	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
-	if (szb > SS(fs)) {		/* Buffer allocated? */
-		memset(ibuf, 0, szb);
-		szb /= SS(fs);		/* Bytes -> Sectors */
-		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
-		ff_memfree(ibuf);
-	} else
-#endif
-	{
-		ibuf = fs->win; szb = 1;	/* Use window buffer (many single-sector writes may take a time) */
-		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+	if (cl >= fp->xm_ncl) return 0;	/* Out of the mapped part? */
+	lo = 0; hi = fp->xm_cnt - 1;
+	while (lo < hi) {	/* Find the last extent started at or before the cluster */
+		mid = (lo + hi + 1) / 2;
+		if (fp->xm_ofs[mid] <= cl) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
 	}
-	return (n == fs->csize) ? FR_OK : FR_DISK_ERR;
+	return fp->xm_clst[lo] + (cl - fp->xm_ofs[lo]);
 }
-#endif	/* !FF_FS_READONLY */
 
 
-
-
-/*-----------------------------------------------------------------------*/
-/* Directory handling - Set directory index                              */
-/*-----------------------------------------------------------------------*/
-
-static FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp,		/* Pointer to directory object */
-	DWORD ofs		/* Offset of directory table */
+static void xmap_add (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD cl,		/* Cluster order from top of the file */
+	DWORD clst		/* Cluster number of it */
 )
 {
-	DWORD csz, clst;
-	FATFS *fs = dp->obj.fs;
+	UINT n = fp->xm_cnt;
 
 
-	if (ofs >= (DWORD)((FF_FS_EXFAT && fs->fs_type == FS_EXFAT) ? MAX_DIR_EX : MAX_DIR) || ofs % SZDIRE) {	/* Check range of offset and alignment */
-		return FR_INT_ERR;
-	}
-	dp->dptr = ofs;				/* Set current offset */
-	clst = dp->obj.sclust;		/* Table start cluster (0:root) */
-	if (clst == 0 && fs->fs_type >= FS_FAT32) {	/* Replace cluster# 0 with root cluster# */
-		clst = (DWORD)fs->dirbase;
-		if (FF_FS_EXFAT) dp->obj.stat = 0;	/* exFAT: Root dir has an FAT chain */
+	if (cl != fp->xm_ncl) return;	/* Only the cluster next to the mapped part can be added */
+	if (n > 0 && clst == fp->xm_clst[n - 1] + (cl - fp->xm_ofs[n - 1])) {	/* Contiguous to the last extent? */
+		fp->xm_ncl++;
+	} else if (n < FF_FS_EXTMAP) {	/* Start a new extent if the map is not full */
+		fp->xm_ofs[n] = cl;
+		fp->xm_clst[n] = clst;
+		fp->xm_cnt = n + 1;
+		fp->xm_ncl++;
 	}
+}
 
-	if (clst == 0) {	/* Static table (root-directory on the FAT volume) */
-		if (ofs / SZDIRE >= fs->n_rootdir) return FR_INT_ERR;	/* Is index out of range? */
-		dp->sect = fs->dirbase;
+
+#if !FF_FS_READONLY && FF_FS_MINIMIZE == 0
+static void xmap_trim (
+	FIL* fp,		/* Pointer to the file object */
+	DWORD ncl		/* Number of clusters left in the file */
+)
+{
+	if (fp->xm_ncl > ncl) fp->xm_ncl = ncl;
+	while (fp->xm_cnt > 0 && fp->xm_ofs[fp->xm_cnt - 1] >= fp->xm_ncl) fp->xm_cnt--;	/* Remove the extents out of the file */
+}
+#endif
+
+#endif	/* FF_FS_EXTMAP */
+
+
+
+
+#if FF_USE_FILEBUF
+/*-----------------------------------------------------------------------*/
+/* File handling - Read-ahead/Write-behind buffer of file object         */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT fill_fbuf (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp,		/* Pointer to the file object */
+	LBA_t sect		/* Sector of fptr to be loaded into buf[] */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	UINT n, ncs;
+	DWORD clst, nxt;
+
+
+	if (sect - fp->ra_sect < fp->ra_cnt) {	/* Is the sector in the read-ahead buffer? */
+		memcpy(fp->buf, fp->fb_buf + (sect - fp->ra_sect) * SS(fs), SS(fs));
+		return FR_OK;
+	}
+	n = fp->ra_win;		/* Number of sectors to read */
+	if (n > 1) {
+		ncs = (UINT)((fp->obj.objsize - fp->fptr + SS(fs) - 1) / SS(fs));	/* Do not read beyond the end of file */
+		if (n > ncs) n = ncs;
+		ncs = fs->csize - (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Rest of the current cluster */
+		for (clst = fp->clust; ncs < n; ncs += fs->csize) {	/* Extend it over the following contiguous clusters */
+#if FF_FS_REENTRANT == 2
+			if (!lock_volume(fs, 0)) break;	/* Take the volume only while following the FAT */
+			nxt = get_fat(&fp->obj, clst);
+			unlock_volume(fs, FR_OK);
+#else
+			nxt = get_fat(&fp->obj, clst);
+#endif
+			if (nxt != clst + 1) break;
+			clst = nxt;
+		}
+		if (n > ncs) n = ncs;
+	}
+	if (fp->fb_size > 1) {	/* Grow the read-ahead window while the access is sequential */
+		fp->ra_win = fp->ra_win ? fp->ra_win * 2 : 2;
+		if (fp->ra_win > fp->fb_size) fp->ra_win = fp->fb_size;
+	}
+	if (n <= 1) {	/* Single sector read */
+		return disk_read(fs->pdrv, fp->buf, sect, 1) == RES_OK ? FR_OK : FR_DISK_ERR;
+	}
+	fp->ra_cnt = 0;
+	if (disk_read(fs->pdrv, fp->fb_buf, sect, n) != RES_OK) return FR_DISK_ERR;	/* Read ahead the sectors in a multi-sector transfer */
+	fp->ra_sect = sect; fp->ra_cnt = n;
+	memcpy(fp->buf, fp->fb_buf, SS(fs));
+	return FR_OK;
+}
+
+
+#if !FF_FS_READONLY
+static FRESULT flush_fbuf (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	if (fp->fb_cnt > 0) {	/* Write the run of sectors in the buffer at a time */
+		if (disk_write(fp->obj.fs->pdrv, fp->fb_buf, fp->fb_sect, fp->fb_cnt) != RES_OK) return FR_DISK_ERR;
+		fp->fb_cnt = 0;
+	}
+	return FR_OK;
+}
+
+
+static FRESULT put_fbuf (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp		/* Pointer to the file object with dirty buf[] */
+)
+{
+	UINT ss = SS(fp->obj.fs);
+
+
+	fp->ra_cnt = 0;	/* The buffer is used to collect the written sectors */
+	if (fp->sect - fp->fb_sect < fp->fb_cnt) {	/* Is the sector in the buffer? */
+		memcpy(fp->fb_buf + (fp->sect - fp->fb_sect) * ss, fp->buf, ss);	/* Update it */
+		CLR_DIRTY(fp);
+		return FR_OK;
+	}
+	if (fp->fb_cnt > 0 && fp->fb_sect + fp->fb_cnt != fp->sect) {	/* Flush the buffer if the sector does not follow the run */
+		if (flush_fbuf(fp) != FR_OK) return FR_DISK_ERR;
+	}
+	if (fp->fb_cnt == 0) fp->fb_sect = fp->sect;
+	memcpy(fp->fb_buf + fp->fb_cnt * ss, fp->buf, ss);	/* Append the sector to the run */
+	CLR_DIRTY(fp);
+	if (++fp->fb_cnt == fp->fb_size) return flush_fbuf(fp);	/* Flush the buffer when it gets full */
+	return FR_OK;
+}
+
+
+static FRESULT sync_fbuf (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	if (fp->fb_size > 0) {	/* Write-back dirty buf[] together with the buffer if it is attached */
+		if ((fp->flag & FA_DIRTY) && put_fbuf(fp) != FR_OK) return FR_DISK_ERR;
+		return flush_fbuf(fp);
+	}
+	return FR_OK;
+}
+#endif
+
+#endif	/* FF_USE_FILEBUF */
+
+
+
+
+#if FF_FS_BUFPOOL
+/*-----------------------------------------------------------------------*/
+/* File handling - Sector buffer pool of file objects                    */
+/*-----------------------------------------------------------------------*/
+
+static UINT lru_pbuf (	/* Returns index of the least recently used pool buffer (FF_FS_BUFPOOL:not found) */
+	FATFS* fs,		/* Filesystem object */
+	int clean		/* Only the buffers not dirty */
+)
+{
+	UINT i, lru = FF_FS_BUFPOOL;
+
+
+	for (i = 0; i < FF_FS_BUFPOOL; i++) {
+		if (clean && fs->pbflag[i]) continue;
+		if (lru == FF_FS_BUFPOOL || fs->pbtick - fs->pbuse[i] > fs->pbtick - fs->pbuse[lru]) lru = i;
+	}
+	return lru;
+}
+
+
+static void chk_pbuf (
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	if (fp->buf && fp->obj.fs->pbtkt[PB_SLOT(fp)] != fp->pbtkt) {	/* Has the buffer been lent to another file? */
+		fp->buf = 0;
+		fp->flag &= (BYTE)~FA_DIRTY;	/* The dirty sector has been written back by the pool */
+	}
+}
+
+
+static FRESULT get_pbuf (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp,		/* Pointer to the file object that needs buf[] */
+	int load		/* Reload the current sector into the buffer if fptr is in middle of it */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	UINT i;
+
+
+	chk_pbuf(fp);
+	if (fp->buf) {	/* Already borrowed? */
+		fs->pbuse[PB_SLOT(fp)] = ++fs->pbtick;
+		return FR_OK;
+	}
+	for (i = 0; i < FF_FS_BUFPOOL && fs->pbtkt[i]; i++) ;	/* Find a free buffer */
+	if (i == FF_FS_BUFPOOL) {	/* Take the least recently used clean buffer, or else the least recently used one */
+		i = lru_pbuf(fs, 1);
+		if (i == FF_FS_BUFPOOL) i = lru_pbuf(fs, 0);
+#if !FF_FS_READONLY
+		if (fs->pbflag[i]) {	/* Write-back the dirty sector of the holder (the holder is not referred) */
+			if (disk_write(fs->pdrv, fs->pbbuf[i], fs->pbsect[i], 1) != RES_OK) return FR_DISK_ERR;
+			fs->pbflag[i] = 0;
+		}
+#endif
+	}
+	if (++fs->pbtick == 0) fs->pbtick = 1;	/* Lending ticket (0 is for free buffers) */
+	fs->pbuse[i] = fs->pbtkt[i] = fp->pbtkt = fs->pbtick;	/* The holder finds the buffer lost by the ticket */
+	fp->buf = fs->pbbuf[i];
+	if (load && fp->sect && fp->fptr % SS(fs)) {	/* Reload the current sector to continue the access in middle of it */
+#if FF_USE_FILEBUF && !FF_FS_READONLY
+		if (fp->fb_size > 0 && fp->sect - fp->fb_sect < fp->fb_cnt) {	/* The sector is in the write-behind run? */
+			memcpy(fp->buf, fp->fb_buf + (fp->sect - fp->fb_sect) * SS(fs), SS(fs));
+			return FR_OK;
+		}
+#endif
+		if (disk_read(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+	} else {
+		fp->sect = 0;	/* buf[] is not filled */
+#if !FF_FS_READONLY
+		memset(fp->buf, 0, SS(fs));	/* Do not leave the data of other files in the sector buffer */
+#endif
+	}
+	return FR_OK;
+}
+
+#endif	/* FF_FS_BUFPOOL */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Fill a cluster with zeros                        */
+/*-----------------------------------------------------------------------*/
+
+#if !FF_FS_READONLY
+static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS *fs,		/* Filesystem object */
+	DWORD clst		/* Directory table to clear */
+)
+{
+	LBA_t sect;
+	UINT n, szb;
+	BYTE *ibuf;
+#if FF_USE_ZERO
+	LBA_t rt[2];
+#endif
+
+
+	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Flush disk access window */
+	sect = clst2sect(fs, clst);		/* Top of the cluster */
+	fs->winsect = sect;				/* Set window to top of the cluster */
+	memset(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
+#if FF_WIN_CACHE
+	wc_discard(fs, sect, fs->csize);	/* Cached sectors of the cluster get stale */
+#endif
+#if FF_USE_ZERO
+	rt[0] = sect; rt[1] = sect + fs->csize - 1;	/* Range of the cluster */
+	if (disk_ioctl(fs->pdrv, CTRL_ZERO, rt) == RES_OK) return FR_OK;	/* Let the device fill the cluster with 0 */
+#endif
+#if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
+	/* Allocate a temporary buffer */
+	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
+	if (szb > SS(fs)) {		/* Buffer allocated? */
+		memset(ibuf, 0, szb);
+		szb /= SS(fs);		/* Bytes -> Sectors */
+		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+		ff_memfree(ibuf);
+	} else
+#endif
+	{
+		ibuf = fs->win; szb = 1;	/* Use window buffer (many single-sector writes may take a time) */
+		for (n = 0; n < fs->csize && disk_write(fs->pdrv, ibuf, sect + n, szb) == RES_OK; n += szb) ;	/* Fill the cluster with 0 */
+	}
+	return (n == fs->csize) ? FR_OK : FR_DISK_ERR;
+}
+#endif	/* !FF_FS_READONLY */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Set directory index                              */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,		/* Pointer to directory object */
+	DWORD ofs		/* Offset of directory table */
+)
+{
+	DWORD csz, clst;
+	FATFS *fs = dp->obj.fs;
+
+
+	if (ofs >= (DWORD)((FF_FS_EXFAT && fs->fs_type == FS_EXFAT) ? MAX_DIR_EX : MAX_DIR) || ofs % SZDIRE) {	/* Check range of offset and alignment */
+		return FR_INT_ERR;
+	}
+	dp->dptr = ofs;				/* Set current offset */
+	clst = dp->obj.sclust;		/* Table start cluster (0:root) */
+	if (clst == 0 && fs->fs_type >= FS_FAT32) {	/* Replace cluster# 0 with root cluster# */
+		clst = (DWORD)fs->dirbase;
+		if (FF_FS_EXFAT) dp->obj.stat = 0;	/* exFAT: Root dir has an FAT chain */
+	}
+
+	if (clst == 0) {	/* Static table (root-directory on the FAT volume) */
+		if (ofs / SZDIRE >= fs->n_rootdir) return FR_INT_ERR;	/* Is index out of range? */
+		dp->sect = fs->dirbase;
 
 	} else {			/* Dynamic table (sub-directory or root-directory on the FAT32/exFAT volume) */
 		csz = (DWORD)fs->csize * SS(fs);	/* Bytes per cluster */
@@ -1825,6 +2906,110 @@ static FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DEN
 
 
 
+#if FF_FS_DIRSCAN
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Test a block of directory entries                */
+/*-----------------------------------------------------------------------*/
+/* The first 16 bytes of each entry are compared with a pattern under a
+/  mask, which gives the first byte, SFN and attribute tests on the 16
+/  entries of a block with a compare per entry (two with AVX2). Runs of
+/  entries to skip shorter than two are left to the entry-wise loop. */
+
+#define DIR_HASNEXT(dp)	((dp)->dptr % DIRSCAN_BLK < DIRSCAN_BLK - SZDIRE)	/* Is the next entry in the same block? */
+#define DIR_INUSE(ent)	((ent)[DIR_Name] != DDEM && (ent)[DIR_Name] != 0)
+
+static const BYTE DirPatEnd[16] = {0};	/* End of directory (Name[0] == 0) */
+#if !FF_FS_READONLY || FF_FS_MINIMIZE <= 1 || FF_USE_LABEL || FF_FS_RPATH >= 2
+static const BYTE DirPatDel[16] = {DDEM};	/* Deleted entry (Name[0] == DDEM) */
+#endif
+static const BYTE DirMskName[16] = {0xFF};	/* Mask of DirPatEnd/DirPatDel */
+#if FF_USE_LFN
+static const BYTE DirPatLfn[16] = {0,0,0,0,0,0,0,0,0,0,0,AM_LFN};	/* LFN entry (Attr & AM_MASK == AM_LFN) */
+static const BYTE DirMskLfn[16] = {0,0,0,0,0,0,0,0,0,0,0,AM_MASK};
+#endif
+
+
+static UINT dir_mask (	/* Bit mask of the entries matched (b0:first entry of the block) */
+	const BYTE* ent,	/* Top of the block of 16 entries */
+	const BYTE* pat,	/* Pattern of the first 16 bytes */
+	const BYTE* msk		/* Mask of the first 16 bytes */
+)
+{
+	UINT m = 0, i;
+
+
+#if SCAN_SIMD == 2		/* AVX2: two entries in a compare */
+	const __m256i pv = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)pat));
+	const __m256i mv = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)msk));
+
+	for (i = 0; i < 16; i += 2) {
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(ent + i * SZDIRE))), _mm_loadu_si128((const __m128i*)(ent + i * SZDIRE + SZDIRE)), 1);
+		DWORD e = (DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, mv), pv));
+
+		if ((e & 0xFFFF) == 0xFFFF) m |= 1 << i;
+		if ((e >> 16) == 0xFFFF) m |= 2 << i;
+	}
+
+#elif SCAN_SIMD == 1	/* SSE2: an entry in a compare */
+	const __m128i pv = _mm_loadu_si128((const __m128i*)pat), mv = _mm_loadu_si128((const __m128i*)msk);
+
+	for (i = 0; i < 16; i++) {
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(_mm_loadu_si128((const __m128i*)(ent + i * SZDIRE)), mv), pv)) == 0xFFFF) m |= 1 << i;
+	}
+
+#elif SCAN_SIMD == 3	/* NEON: an entry in a compare */
+	const uint8x16_t pv = vld1q_u8(pat), mv = vld1q_u8(msk);
+
+	for (i = 0; i < 16; i++) {
+		if (vminvq_u8(vceqq_u8(vandq_u8(vld1q_u8(ent + i * SZDIRE), mv), pv)) == 0xFF) m |= 1 << i;
+	}
+
+#else					/* Portable code: four words in a compare */
+	DWORD pw[4], mw[4];
+
+	for (i = 0; i < 4; i++) {
+		pw[i] = ld_32(pat + i * 4); mw[i] = ld_32(msk + i * 4);
+	}
+	for (i = 0; i < 16; i++, ent += SZDIRE) {
+		if ((ld_32(ent) & mw[0]) == pw[0] && (ld_32(ent + 4) & mw[1]) == pw[1] && (ld_32(ent + 8) & mw[2]) == pw[2] && (ld_32(ent + 12) & mw[3]) == pw[3]) m |= 1 << i;
+	}
+
+#endif
+	return m;
+}
+
+
+static UINT dir_skip (	/* Number of entries skipped */
+	DIR* dp,			/* Directory object */
+	UINT m				/* Bit mask of the entries to stop at in the block of current entry */
+)
+{
+	UINT i = dp->dptr % DIRSCAN_BLK / SZDIRE, n;
+
+
+	m = (m & 0xFFFF) >> i;
+	if (m) {
+		for (n = 0; !(m & 1); m >>= 1, n++) ;	/* Move to the first entry in the mask */
+	} else {
+		n = 15 - i;			/* or the last entry of the block */
+	}
+	dp->dptr += n * SZDIRE; dp->dir += n * SZDIRE;	/* Stay in the block, so that in the sector */
+	return n;
+}
+
+
+static const BYTE* dir_block (	/* Top of the block of current entry in the win[] */
+	DIR* dp
+)
+{
+	return dp->dir - dp->dptr % DIRSCAN_BLK;
+}
+
+#endif	/* FF_FS_DIRSCAN */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Reserve a block of directory entries             */
@@ -1846,6 +3031,12 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 		do {
 			res = move_window(fs, dp->sect);
 			if (res != FR_OK) break;
+#if FF_FS_DIRSCAN
+			if (fs->fs_type != FS_EXFAT && DIR_INUSE(dp->dir) && DIR_HASNEXT(dp) && DIR_INUSE(dp->dir + SZDIRE)) {	/* Skip a run of entries in use in the block */
+				n = 0;
+				dir_skip(dp, dir_mask(dir_block(dp), DirPatEnd, DirMskName) | dir_mask(dir_block(dp), DirPatDel, DirMskName));
+			}
+#endif
 #if FF_FS_EXFAT
 			if ((fs->fs_type == FS_EXFAT) ? (int)((dp->dir[XDIR_Type] & 0x80) == 0) : (int)(dp->dir[DIR_Name] == DDEM || dp->dir[DIR_Name] == 0)) {	/* Is the entry free? */
 #else
@@ -2357,6 +3548,15 @@ static FRESULT dir_read (
 		res = move_window(fs, dp->sect);
 		if (res != FR_OK) break;
 		et = dp->dir[DIR_Name];	/* Test for the entry type */
+#if FF_FS_DIRSCAN
+		if (et == DDEM && fs->fs_type != FS_EXFAT && DIR_HASNEXT(dp) && dp->dir[SZDIRE + DIR_Name] == DDEM) {	/* Skip a run of deleted entries in the block */
+#if FF_USE_LFN
+			ord = 0xFF;
+#endif
+			dir_skip(dp, ~dir_mask(dir_block(dp), DirPatDel, DirMskName));
+			et = dp->dir[DIR_Name];
+		}
+#endif
 		if (et == 0) {
 			res = FR_NO_FILE; break; /* Reached to end of the directory */
 		}
@@ -2416,11 +3616,12 @@ static FRESULT dir_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
+/* Directory handling - Find an object from the current position         */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT dir_scan (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object with the file name */
+	DWORD end				/* Offset of the last entry to be examined */
 )
 {
 	FRESULT res;
@@ -2429,36 +3630,46 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 #if FF_USE_LFN
 	BYTE attr, ord, sum;
 #endif
+#if FF_FS_DIRSCAN
+	BYTE pat[16], msk[16];
+	DWORD mblk = 0xFFFFFFFF;
+	UINT m = 0;
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
-#if FF_FS_EXFAT
-	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
-		BYTE nc;
-		UINT di, ni;
-		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+	memcpy(pat, dp->fn, 11); memset(pat + 11, 0, 5);	/* Pattern of the SFN entry with the name */
+	memset(msk, 0xFF, 11); msk[11] = AM_VOL; memset(msk + 12, 0, 4);
+#endif
 
-		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
-#if FF_MAX_LFN < 255
-			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;		/* Skip comparison if inaccessible object name */
-#endif
-			if (ld_16(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
-			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
-				if ((di % SZDIRE) == 0) di += 2;
-				if (ff_wtoupper(ld_16(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
-			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
-		}
-		return res;
-	}
-#endif
-	/* On the FAT/FAT32 volume */
-#if FF_USE_LFN
-	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+#if FF_USE_LFN
+	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
 	do {
+		if (dp->dptr > end) { res = FR_NO_FILE; break; }	/* Reached end of the range */
 		res = move_window(fs, dp->sect);
 		if (res != FR_OK) break;
+#if FF_FS_DIRSCAN
+#if FF_USE_LFN
+		if (ord == 0xFF) {	/* Out of an LFN sequence? */
+#else
+		{
+#endif
+			if (dp->dptr / DIRSCAN_BLK != mblk) {	/* Get the entries to stop at in the block: end of directory, the SFN and LFN entries */
+				mblk = dp->dptr / DIRSCAN_BLK;
+				m = dir_mask(dir_block(dp), DirPatEnd, DirMskName);
+#if FF_USE_LFN
+				if (!(dp->fn[NSFLAG] & NS_LOSS)) m |= dir_mask(dir_block(dp), pat, msk);
+				if (!(dp->fn[NSFLAG] & NS_NOLFN)) m |= dir_mask(dir_block(dp), DirPatLfn, DirMskLfn);
+#else
+				m |= dir_mask(dir_block(dp), pat, msk);
+#endif
+			}
+			if (dir_skip(dp, m)) {	/* Skip the entries that cannot match */
+#if FF_USE_LFN
+				dp->blk_ofs = 0xFFFFFFFF;
+#endif
+				if (dp->dptr > end) { res = FR_NO_FILE; break; }
+			}
+		}
+#endif
 		et = dp->dir[DIR_Name];		/* Entry type */
 		if (et == 0) { res = FR_NO_FILE; break; }	/* Reached end of directory table */
 #if FF_USE_LFN		/* LFN configuration */
@@ -2483,14 +3694,472 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Not matched, reset LFN sequence */
 			}
 		}
-#else		/* Non LFN configuration */
-		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
-		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+#else		/* Non LFN configuration */
+		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+#endif
+		res = dir_next(dp, 0);	/* Next entry */
+	} while (res == FR_OK);
+
+	return res;
+}
+
+
+
+
+#if FF_FS_DIRINDEX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name hash index of directory                     */
+/*-----------------------------------------------------------------------*/
+/* An index is a block of DWORDs: [0]:number of buckets (power of 2),
+/  [1]:number of records, [2]:top of free record list, and then bucket
+/  heads and records of {name hash, offset of the entry block, offset of
+/  the SFN entry, next record}. A name hash is FNV-1a of the SFN, or the
+/  sum of mixed up-cased characters and their positions of the LFN that
+/  can be taken from the LFN entries in any order. */
+
+#define DX_NONE			0xFFFFFFFF
+#define DX_HEAD(t)		((t) + 3)
+#define DX_REC(t, i)	((t) + 3 + (t)[0] + (i) * 4)
+#define DX_MINOFS(fs)	(2 * SS(fs))	/* Directories scanned past this offset get an index */
+
+
+static DWORD dx_sfn (	/* Hash value of the SFN */
+	const BYTE* sfn		/* Pointer to the SFN */
+)
+{
+	DWORD hash = 2166136261;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) hash = (hash ^ sfn[i]) * 16777619;
+	return hash;
+}
+
+
+#if FF_USE_LFN
+static DWORD dx_lfn (	/* Hash value of an LFN character to be summed up */
+	UINT pos,			/* Position in the LFN */
+	WCHAR wc			/* The character */
+)
+{
+	DWORD x = ((DWORD)ff_wtoupper(wc) << 9 | pos) * 0x9E3779B1;
+
+
+	return x ^ x >> 15;
+}
+
+
+static DWORD dx_lfnent (	/* Hash value of the characters in an LFN entry to be summed up */
+	const BYTE* dir		/* Pointer to the LFN entry */
+)
+{
+	DWORD hash = 0;
+	WCHAR wc;
+	UINT i;
+
+
+	for (i = 0; i < 13 && (wc = ld_16(dir + LfnOfs[i])) != 0; i++) {
+		hash += dx_lfn(((dir[LDIR_Ord] & 0x3F) - 1) * 13 + i, wc);
+	}
+	return hash;
+}
+#endif
+
+
+static DWORD* dx_create (	/* Pointer to the new index (null:not enough core) */
+	DWORD nrec			/* Number of records */
+)
+{
+	DWORD *t, nb, i;
+
+
+	for (nb = 16; nb < nrec; nb *= 2) ;
+	t = ff_memalloc((UINT)((3 + nb + nrec * 4) * 4));
+	if (t) {
+		t[0] = nb; t[1] = nrec; t[2] = 0;
+		for (i = 0; i < nb; i++) DX_HEAD(t)[i] = DX_NONE;
+		for (i = 0; i < nrec; i++) DX_REC(t, i)[3] = (i + 1 < nrec) ? i + 1 : DX_NONE;	/* Chain all records into the free list */
+	}
+	return t;
+}
+
+
+static int dx_put (	/* 1:Added, 0:Not enough core */
+	DWORD** tp,		/* Pointer to the index (replaced with a larger one when full) */
+	DWORD hash,		/* Name hash */
+	DWORD blk,		/* Offset of the entry block */
+	DWORD ofs		/* Offset of the SFN entry */
+)
+{
+	DWORD *t = *tp, *nt, *r, i;
+
+
+	if (t[2] == DX_NONE) {	/* Move the records into an index twice as large if full */
+		nt = dx_create(t[1] * 2);
+		if (!nt) return 0;
+		for (i = 0; i < t[1]; i++) {
+			r = DX_REC(t, i);
+			dx_put(&nt, r[0], r[1], r[2]);
+		}
+		ff_memfree(t);
+		*tp = t = nt;
+	}
+	i = t[2]; r = DX_REC(t, i);
+	t[2] = r[3];			/* Take a record from the free list */
+	r[0] = hash; r[1] = blk; r[2] = ofs;
+	r[3] = DX_HEAD(t)[hash & (t[0] - 1)];	/* Link it into the bucket */
+	DX_HEAD(t)[hash & (t[0] - 1)] = i;
+	return 1;
+}
+
+
+static DWORD* dx_get (	/* Pointer to the index of the directory (null:not indexed) */
+	FATFS* fs,			/* Filesystem object */
+	DWORD clst			/* Start cluster of the directory */
+)
+{
+	DWORD *t;
+	UINT i;
+
+
+	clst = DIR_KEY(fs, clst);
+	for (i = 0; i < FF_FS_DIRINDEX && fs->dxtbl[i] && fs->dxclst[i] != clst; i++) ;
+	if (i == FF_FS_DIRINDEX || !fs->dxtbl[i]) return 0;
+	t = fs->dxtbl[i];
+	for ( ; i > 0; i--) {	/* Move it to the top of the list */
+		fs->dxtbl[i] = fs->dxtbl[i - 1]; fs->dxclst[i] = fs->dxclst[i - 1];
+	}
+	fs->dxtbl[0] = t; fs->dxclst[0] = clst;
+	return t;
+}
+
+
+static void dx_drop (
+	FATFS* fs,			/* Filesystem object */
+	DWORD clst			/* Start cluster of the directory (DX_NONE:all directories) */
+)
+{
+	UINT i, j;
+
+
+	clst = DIR_KEY(fs, clst);
+	for (i = j = 0; i < FF_FS_DIRINDEX; i++) {
+		if (clst == DX_NONE || fs->dxclst[i] == clst) {	/* Discard it */
+			ff_memfree(fs->dxtbl[i]);
+		} else {										/* Keep it */
+			fs->dxclst[j] = fs->dxclst[i]; fs->dxtbl[j++] = fs->dxtbl[i];
+		}
+	}
+	while (j < FF_FS_DIRINDEX) fs->dxtbl[j++] = 0;
+}
+
+
+static void dx_build (
+	DIR* dp				/* Directory to be indexed (the directory object is not changed) */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DIR dj;
+	DWORD *t, hash = 0, blk = DX_NONE;
+	BYTE et, attr;
+	UINT i;
+
+
+	if (fs->dxtbl[FF_FS_DIRINDEX - 1]) dx_drop(fs, fs->dxclst[FF_FS_DIRINDEX - 1]);	/* Discard the least recently used index */
+	t = dx_create(256);
+	if (!t) return;
+	dj.obj = dp->obj;
+	res = dir_sdi(&dj, 0);
+	while (res == FR_OK) {	/* Put all entries that dir_scan() can find */
+		res = move_window(fs, dj.sect);
+		if (res != FR_OK) break;
+		et = dj.dir[DIR_Name];
+		if (et == 0) break;		/* End of table */
+		attr = dj.dir[DIR_Attr] & AM_MASK;
+		if (et == DDEM || ((attr & AM_VOL) && attr != AM_LFN)) {	/* An entry without valid data */
+			blk = DX_NONE;
+#if FF_USE_LFN
+		} else if (attr == AM_LFN) {	/* LFN entry */
+			if (et & LLEF) {		/* Start of an entry set */
+				blk = dj.dptr; hash = 0;
+			}
+			if ((et & 0x3F) == 0) blk = DX_NONE;
+			if (blk != DX_NONE) hash += dx_lfnent(dj.dir);	/* Sum up the characters in the entry */
+#endif
+		} else {					/* SFN entry (found with the SFN from the LFN entries as dir_scan() does) */
+			i = (blk == DX_NONE || dx_put(&t, hash, blk, dj.dptr)) && dx_put(&t, dx_sfn(dj.dir), blk != DX_NONE ? blk : dj.dptr, dj.dptr);
+			if (!i) {
+				res = FR_NOT_ENOUGH_CORE; break;
+			}
+			blk = DX_NONE;
+		}
+		res = dir_next(&dj, 0);
+	}
+	if (res != FR_OK && res != FR_NO_FILE) {	/* Abandon it on error */
+		ff_memfree(t);
+		return;
+	}
+	for (i = FF_FS_DIRINDEX - 1; i > 0; i--) {	/* Put it on the top of the list */
+		fs->dxtbl[i] = fs->dxtbl[i - 1]; fs->dxclst[i] = fs->dxclst[i - 1];
+	}
+	fs->dxtbl[0] = t; fs->dxclst[0] = DIR_KEY(fs, dp->obj.sclust);
+}
+
+
+static FRESULT dx_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,			/* Pointer to the directory object with the file name */
+	DWORD* t			/* Index of the directory */
+)
+{
+	FRESULT res;
+	DWORD hash[2], *r, i;
+	UINT n = 0, k;
+#if FF_USE_LFN
+	FATFS *fs = dp->obj.fs;
+
+
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) {		/* Find the entries with the LFN */
+		for (hash[0] = 0, k = 0; fs->lfnbuf[k]; k++) hash[0] += dx_lfn(k, fs->lfnbuf[k]);
+		n++;
+	}
+	if (!(dp->fn[NSFLAG] & NS_LOSS)) hash[n++] = dx_sfn(dp->fn);	/* Find the entries with the SFN */
+#else
+	hash[n++] = dx_sfn(dp->fn);
+#endif
+	for (k = 0; k < n; k++) {
+		for (i = DX_HEAD(t)[hash[k] & (t[0] - 1)]; i != DX_NONE; i = r[3]) {
+			r = DX_REC(t, i);
+			if (r[0] != hash[k]) continue;
+			res = dir_sdi(dp, r[1]);	/* Compare the entry block */
+			if (res == FR_OK) res = dir_scan(dp, r[2]);
+			if (res != FR_NO_FILE) return res;	/* Found or error */
+		}
+	}
+	return FR_NO_FILE;
+}
+
+
+#if !FF_FS_READONLY
+static void dx_add (
+	DIR* dp				/* Directory object pointing the entry just registered */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	int ok;
+#if FF_USE_LFN
+	DWORD hash = 0;
+	UINT i;
+#endif
+
+
+	if (!dx_get(fs, dp->obj.sclust)) return;	/* Not indexed */
+#if FF_USE_LFN
+	ok = dx_put(&fs->dxtbl[0], dx_sfn(dp->fn), dp->blk_ofs != DX_NONE ? dp->blk_ofs : dp->dptr, dp->dptr);	/* Found from the top of the entry block */
+	if (ok && dp->blk_ofs != DX_NONE) {	/* With LFN entries */
+		for (i = 0; fs->lfnbuf[i]; i++) hash += dx_lfn(i, fs->lfnbuf[i]);
+		ok = dx_put(&fs->dxtbl[0], hash, dp->blk_ofs, dp->dptr);
+	}
+#else
+	ok = dx_put(&fs->dxtbl[0], dx_sfn(dp->fn), dp->dptr, dp->dptr);
+#endif
+	if (!ok) dx_drop(fs, dp->obj.sclust);	/* Discard the index that cannot be kept up to date */
+}
+
+
+#if FF_FS_MINIMIZE == 0
+static void dx_remove (
+	DIR* dp,			/* Directory object pointing the SFN entry just removed */
+	const DWORD* hash,	/* Name hashes of the entry taken before the removal */
+	UINT n				/* Number of the name hashes */
+)
+{
+	DWORD *t, *r, *p, i;
+	UINT k;
+
+
+	t = dx_get(dp->obj.fs, dp->obj.sclust);
+	if (!t) return;		/* Not indexed */
+	for (k = 0; k < n; k++) {	/* Unlink the records of the entry from the buckets of its names */
+		for (p = &DX_HEAD(t)[hash[k] & (t[0] - 1)]; *p != DX_NONE; ) {
+			r = DX_REC(t, *p);
+			if (r[2] == dp->dptr) {
+				i = *p; *p = r[3];
+				r[3] = t[2]; t[2] = i;	/* Return it to the free list */
+			} else {
+				p = &r[3];
+			}
+		}
+	}
+}
+#endif
+#endif
+
+#endif	/* FF_FS_DIRINDEX */
+
+
+#if FF_FS_DCACHE
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Path cache                                       */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dc_find (	/* FR_OK:found, FR_NO_FILE:not in the cache, FR_DISK_ERR:disk error */
+	DIR* dp					/* Directory object with the segment name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	FFDCENT *e;
+	DWORD dclst;
+	UINT i;
+#if FF_USE_LFN
+	UINT n;
+#endif
+
+
+	if (fs->fs_type == FS_EXFAT || (dp->fn[NSFLAG] & NS_DOT)) return FR_NO_FILE;
+	dclst = DIR_KEY(fs, dp->obj.sclust);
+	for (i = 0; i < FF_FS_DCACHE; i++) {	/* Find the name in the directory */
+		e = &fs->dcent[i];
+		if (!e->use || e->dclst != dclst) continue;
+#if FF_USE_LFN
+		for (n = 0; e->name[n] && e->name[n] == fs->lfnbuf[n]; n++) ;
+		if (e->name[n] == fs->lfnbuf[n]) break;
+#else
+		if (!memcmp(e->name, dp->fn, 11)) break;
+#endif
+	}
+	if (i == FF_FS_DCACHE) return FR_NO_FILE;
+
+	if (!(dp->fn[NSFLAG] & NS_LAST)) {	/* Intermediate segment: get into the sub-directory without reading the entry */
+		if (!(e->attr & AM_DIR)) return FR_NO_FILE;	/* Let dir_find() follow the error */
+		e->use = ++fs->dctick;
+		dp->obj.attr = e->attr;
+		dp->obj.sclust = e->sclust;
+		return FR_OK;
+	}
+	e->use = ++fs->dctick;				/* Last segment: load the entry the caller works on */
+	dp->dptr = e->dptr; dp->clust = e->clust; dp->sect = e->sect;
+#if FF_USE_LFN
+	dp->blk_ofs = e->blk_ofs;
+#endif
+	res = move_window(fs, dp->sect);
+	if (res == FR_OK) {
+		dp->dir = fs->win + dp->dptr % SS(fs);
+		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+	}
+	return res;
+}
+
+
+static void dc_put (
+	DIR* dp			/* Directory object pointing the SFN entry just found */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	FFDCENT *e;
+	UINT i;
+#if FF_USE_LFN
+	UINT n;
+#endif
+
+
+	if (fs->fs_type == FS_EXFAT || (dp->fn[NSFLAG] & NS_DOT)) return;
+#if FF_USE_LFN
+	for (n = 0; fs->lfnbuf[n]; n++) ;
+	if (n >= sizeof fs->dcent[0].name / sizeof fs->dcent[0].name[0]) return;	/* Too long name to be recorded */
+#endif
+	e = &fs->dcent[0];
+	for (i = 1; i < FF_FS_DCACHE; i++) {	/* Take the least recently used entry */
+		if (fs->dcent[i].use < e->use) e = &fs->dcent[i];
+	}
+	e->use = ++fs->dctick;
+	e->dclst = DIR_KEY(fs, dp->obj.sclust);
+	e->dptr = dp->dptr; e->clust = dp->clust; e->sect = dp->sect;
+	e->sclust = ld_clust(fs, dp->dir);
+	e->attr = dp->obj.attr;
+#if FF_USE_LFN
+	e->blk_ofs = dp->blk_ofs;
+	memcpy(e->name, fs->lfnbuf, (n + 1) * sizeof (WCHAR));
+#else
+	memcpy(e->name, dp->fn, 11);
+#endif
+}
+
+
+#if !FF_FS_READONLY && FF_FS_MINIMIZE == 0
+static void dc_remove (
+	DIR* dp			/* Directory object pointing the SFN entry just removed */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DWORD dclst = DIR_KEY(fs, dp->obj.sclust);
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_DCACHE; i++) {	/* Discard the entries of the object */
+		if (fs->dcent[i].dclst == dclst && fs->dcent[i].dptr == dp->dptr) fs->dcent[i].use = 0;
+	}
+}
+#endif
+
+#endif	/* FF_FS_DCACHE */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+#if FF_FS_EXFAT || FF_FS_DIRINDEX
+	FATFS *fs = dp->obj.fs;
+#endif
+#if FF_FS_DIRINDEX
+	DWORD *t;
+#endif
+
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
+
+		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+#if FF_MAX_LFN < 255
+			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;		/* Skip comparison if inaccessible object name */
+#endif
+			if (ld_16(fs->dirbuf + XDIR_NameHash) != hash) continue;	/* Skip comparison if hash mismatched */
+			for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+				if ((di % SZDIRE) == 0) di += 2;
+				if (ff_wtoupper(ld_16(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
+			}
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
 #endif
-		res = dir_next(dp, 0);	/* Next entry */
-	} while (res == FR_OK);
-
+	/* On the FAT/FAT32 volume */
+#if FF_FS_DIRINDEX
+	t = dx_get(fs, dp->obj.sclust);
+	if (t) return dx_find(dp, t);	/* Look up the index if exist */
+	res = dir_scan(dp, DX_NONE);
+	if ((res == FR_OK || res == FR_NO_FILE) && dp->dptr >= DX_MINOFS(fs)) {	/* Index the directory if it is large */
+		dx_build(dp);
+		if (res == FR_OK) res = move_window(fs, dp->sect);	/* Restore the window of the found entry */
+	}
 	return res;
+#else
+	return dir_scan(dp, 0xFFFFFFFF);
+#endif
 }
 
 
@@ -2569,9 +4238,11 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	/* Create an SFN with/without LFNs. */
 	n_ent = (sn[NSFLAG] & NS_LFN) ? (len + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
 	res = dir_alloc(dp, n_ent);		/* Allocate entries */
+	dp->blk_ofs = 0xFFFFFFFF;
 	if (res == FR_OK && --n_ent) {	/* Set LFN entry if needed */
 		res = dir_sdi(dp, dp->dptr - n_ent * SZDIRE);
 		if (res == FR_OK) {
+			dp->blk_ofs = dp->dptr;	/* Start offset of LFN */
 			BYTE sum = sum_sfn(dp->fn);	/* Checksum value of the SFN tied to the LFN */
 
 			do {					/* Store LFN entries in bottom first */
@@ -2601,6 +4272,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			fs->wflag = 1;
 		}
 	}
+#if FF_FS_DIRINDEX
+	if (res == FR_OK) dx_add(dp);	/* Put it into the index of the directory */
+#endif
 
 	return res;
 }
@@ -2620,9 +4294,16 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 {
 	FRESULT res;
 	FATFS *fs = dp->obj.fs;
+#if FF_FS_DIRINDEX
+	DWORD hash[2] = {0, 0};	/* Name hashes of the entry to find its records in the index */
+	UINT n = 1;
+#endif
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
 
+#if FF_FS_DIRINDEX
+	if (dp->blk_ofs != 0xFFFFFFFF) n = 2;
+#endif
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
@@ -2631,6 +4312,13 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 			if (FF_FS_EXFAT && fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 				dp->dir[XDIR_Type] &= 0x7F;	/* Clear the entry InUse flag. */
 			} else {										/* On the FAT/FAT32 volume */
+#if FF_FS_DIRINDEX
+				if (dp->dptr < last) {	/* Take the name hashes before deletion */
+					hash[1] += dx_lfnent(dp->dir);
+				} else {
+					hash[0] = dx_sfn(dp->dir);
+				}
+#endif
 				dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'. */
 			}
 			fs->wflag = 1;
@@ -2643,10 +4331,19 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 
 	res = move_window(fs, dp->sect);
 	if (res == FR_OK) {
+#if FF_FS_DIRINDEX
+		hash[0] = dx_sfn(dp->dir);	/* Take the name hash before deletion */
+#endif
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
 		fs->wflag = 1;
 	}
 #endif
+#if FF_FS_DIRINDEX
+	if (res == FR_OK) dx_remove(dp, hash, n);	/* Remove it from the index of the directory */
+#endif
+#if FF_FS_DCACHE
+	if (res == FR_OK) dc_remove(dp);	/* Remove it from the path cache */
+#endif
 
 	return res;
 }
@@ -3178,7 +4875,16 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 				continue;		/* Follow next segment */
 			}
 #endif
+#if FF_FS_DCACHE
+			res = dc_find(dp);				/* Find the object in the path cache */
+			if (res == FR_OK && !(ns & NS_LAST)) continue;	/* Got into the sub-directory */
+			if (res == FR_NO_FILE) {
+				res = dir_find(dp);			/* Find an object with the segment name */
+				if (res == FR_OK) dc_put(dp);	/* Record it in the path cache */
+			}
+#else
 			res = dir_find(dp);				/* Find an object with the segment name */
+#endif
 			if (res != FR_OK) {				/* Failed to find the object */
 				if (res == FR_NO_FILE) {	/* Object is not found */
 					if (FF_FS_RPATH && (ns & NS_DOT)) {	/* If dot entry is not exist, stay there (may be root dir in FAT volume) */
@@ -3384,6 +5090,10 @@ static UINT check_fs (	/* 0:FAT/FAT32 VBR, 1:exFAT VBR, 2:Not FAT and valid BS,
 
 
 	fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;		/* Invaidate window */
+#if FF_WIN_CACHE
+	memset(fs->wcuse, 0, sizeof fs->wcuse);			/* Invalidate window cache */
+	memset(fs->wcflag, 0, sizeof fs->wcflag);
+#endif
 	if (move_window(fs, sect) != FR_OK) return 4;	/* Load the boot sector */
 	sign = ld_16(fs->win + BS_55AA);
 #if FF_FS_EXFAT
@@ -3509,6 +5219,27 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* Following code attempts to mount the volume. (find an FAT volume, analyze the BPB and initialize the filesystem object) */
 
 	fs->fs_type = 0;					/* Invalidate the filesystem object */
+#if FF_FS_FATRAM
+	ff_memfree(fs->fatram);				/* Discard the FAT copy of the previous mount */
+	fs->fatram = 0;
+#endif
+#if FF_FS_FREEMAP
+	ff_memfree(fs->freemap);			/* Discard the bitmap of the previous mount */
+	fs->freemap = 0;
+#endif
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+	ff_memfree(fs->fat2dirty);			/* Discard the deferred FAT sectors of the previous mount */
+	fs->fat2dirty = 0;
+#endif
+#if FF_FS_DIRINDEX
+	dx_drop(fs, DX_NONE);				/* Discard the directory indexes of the previous mount */
+#endif
+#if FF_FS_DCACHE
+	memset(fs->dcent, 0, sizeof fs->dcent);	/* Discard the path cache of the previous mount */
+#endif
+#if FF_FS_FCACHE && !FF_FS_READONLY
+	memset(fs->fcent, 0, sizeof fs->fcent);	/* Discard the last cluster cache of the previous mount */
+#endif
 	stat = disk_initialize(fs->pdrv);	/* Initialize the volume hosting physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
 		return FR_NOT_READY;			/* Failed to initialize due to no medium or hard error */
@@ -3671,8 +5402,28 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #endif	/* !FF_FS_READONLY */
 	}
 
+#if FF_FS_FATRAM
+	if (fmt != FS_EXFAT) load_fatram(fs);	/* Load the FAT into the memory if possible */
+#endif
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+	if (fmt != FS_EXFAT && fs->n_fats == 2) {	/* Prepare the bitmap of the FAT sectors to be reflected later (reflect immediately if not enough core) */
+		fs->fat2dirty = ff_memalloc((UINT)((fs->fsize + 7) / 8));
+		if (fs->fat2dirty) memset(fs->fat2dirty, 0, (fs->fsize + 7) / 8);
+	}
+#endif
+#if FF_FS_FREEMAP
+	if (fmt != FS_EXFAT) {
+		fs->fs_type = (BYTE)fmt;	/* (get_fat() needs the FAT type) */
+		build_freemap(fs);			/* Build the free cluster bitmap if possible */
+		fs->fs_type = 0;
+	}
+#endif
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type (the filesystem object gets valid) */
 	fs->id = ++Fsid;		/* Volume mount ID */
+#if FF_FS_BUFPOOL
+	memset(fs->pbtkt, 0, sizeof fs->pbtkt);	/* All pool buffers are free */
+	memset(fs->pbflag, 0, sizeof fs->pbflag);
+#endif
 
 #if FF_USE_LFN == 1			/* Initilize pointers to the static working buffers */
 	fs->lfnbuf = LfnBuf;	/* LFN working buffer */
@@ -3708,10 +5459,28 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 )
 {
 	FRESULT res = FR_INVALID_OBJECT;
+#if FF_FS_REENTRANT == 2
+	UINT lid;
+#endif
 
 
 	if (obj && obj->fs && obj->fs->fs_type && obj->id == obj->fs->id) {	/* Test if the object is valid */
-#if FF_FS_REENTRANT
+#if FF_FS_REENTRANT == 2
+		lid = obj->lockid;				/* Take the object lock prior to the volume lock */
+		if (lid && !ff_mutex_take(FF_VOLUMES + lid)) {
+			res = FR_TIMEOUT;
+		} else if (lock_volume(obj->fs, 0)) {	/* Take a grant to access the volume */
+			obj->fs->olock = lid;		/* The object lock is released with the volume lock */
+			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) { /* Test if the hosting physical drive is kept initialized */
+				res = FR_OK;
+			} else {
+				unlock_volume(obj->fs, FR_OK);	/* Invalidated volume, abort to access */
+			}
+		} else {	/* Could not take */
+			if (lid) ff_mutex_give(FF_VOLUMES + lid);
+			res = FR_TIMEOUT;
+		}
+#elif FF_FS_REENTRANT
 		if (lock_volume(obj->fs, 0)) {	/* Take a grant to access the volume */
 			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) { /* Test if the hosting physical drive is kept initialized */
 				res = FR_OK;
@@ -3732,6 +5501,35 @@ static FRESULT validate (	/* Returns FR_OK or FR_INVALID_OBJECT */
 }
 
 
+#if FF_FS_REENTRANT == 2
+static FRESULT validate_rd (	/* Returns FR_OK, FR_INVALID_OBJECT or FR_TIMEOUT */
+	FIL* fp,				/* Pointer to the file object to check validity */
+	FATFS** rfs				/* Pointer to pointer to the owner filesystem object to return */
+)
+{
+	FRESULT res = FR_INVALID_OBJECT;
+	FFOBJID *obj = &fp->obj;
+
+
+	if (obj->fs && obj->fs->fs_type && obj->id == obj->fs->id) {	/* Test if the object is valid */
+		if (ff_mutex_take(FF_VOLUMES + obj->lockid)) {	/* Take only the object lock, the volume is locked when the FAT is needed */
+			if (!(disk_status(obj->fs->pdrv) & STA_NOINIT)) {
+				res = FR_OK;
+			} else {
+				ff_mutex_give(FF_VOLUMES + obj->lockid);
+			}
+		} else {
+			res = FR_TIMEOUT;
+		}
+	}
+	*rfs = (res == FR_OK) ? obj->fs : 0;
+	return res;
+}
+#else
+#define validate_rd(fp, rfs)	validate(&(fp)->obj, rfs)
+#endif
+
+
 
 
 /*---------------------------------------------------------------------------
@@ -3756,6 +5554,9 @@ FRESULT f_mount (
 	int vol;
 	FRESULT res;
 	const TCHAR *rp = path;
+#if FF_FS_REENTRANT == 2
+	int i;
+#endif
 
 
 	/* Get volume ID (logical drive number) */
@@ -3772,6 +5573,21 @@ FRESULT f_mount (
 		ff_mutex_delete(vol);
 #endif
 		cfs->fs_type = 0;		/* Invalidate the filesystem object to be unregistered */
+#if FF_FS_FATRAM
+		ff_memfree(cfs->fatram);	/* Discard the FAT copy */
+		cfs->fatram = 0;
+#endif
+#if FF_FS_FREEMAP
+		ff_memfree(cfs->freemap);	/* Discard the free cluster bitmap */
+		cfs->freemap = 0;
+#endif
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+		ff_memfree(cfs->fat2dirty);	/* Discard the deferred FAT sectors */
+		cfs->fat2dirty = 0;
+#endif
+#if FF_FS_DIRINDEX
+		dx_drop(cfs, DX_NONE);		/* Discard the directory indexes */
+#endif
 	}
 
 	if (fs) {					/* Register new filesystem object */
@@ -3785,11 +5601,35 @@ FRESULT f_mount (
 				ff_mutex_delete(vol);
 				return FR_INT_ERR;
 			}
+#if FF_FS_REENTRANT == 2
+			for (i = 1; i <= FF_FS_LOCK && ff_mutex_create(FF_VOLUMES + i); i++) ;	/* Create the object mutexes */
+			if (i <= FF_FS_LOCK) {
+				while (--i) ff_mutex_delete(FF_VOLUMES + i);
+				ff_mutex_delete(FF_VOLUMES);
+				ff_mutex_delete(vol);
+				return FR_INT_ERR;
+			}
+#endif
 			SysLock = 1;		/* System mutex is ready */
 		}
 #endif
+#if FF_FS_REENTRANT == 2
+		fs->olock = 0;
+#endif
 #endif
 		fs->fs_type = 0;		/* Invalidate the new filesystem object */
+#if FF_FS_FATRAM
+		fs->fatram = 0;			/* No FAT copy yet */
+#endif
+#if FF_FS_FREEMAP
+		fs->freemap = 0;		/* No free cluster bitmap yet */
+#endif
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+		fs->fat2dirty = 0;		/* No deferred FAT sector yet */
+#endif
+#if FF_FS_DIRINDEX
+		memset(fs->dxtbl, 0, sizeof fs->dxtbl);	/* No directory index yet */
+#endif
 		FatFs[vol] = fs;		/* Register it */
 	}
 
@@ -3946,24 +5786,47 @@ FRESULT f_open (
 			}
 #if FF_USE_FASTSEEK
 			fp->cltbl = 0;		/* Disable fast seek mode */
+#endif
+#if FF_FS_EXTMAP
+			fp->xm_cnt = 0; fp->xm_ncl = 0;	/* Empty cluster map */
+#endif
+#if FF_USE_FILEBUF
+			fp->fb_size = 0;	/* No file buffer */
+			fp->ra_pos = 0; fp->ra_win = 0; fp->ra_cnt = 0;	/* Nothing read ahead */
+#if !FF_FS_READONLY
+			fp->fb_cnt = 0;
+#endif
 #endif
 			fp->obj.id = fs->id;	/* Set current volume mount ID */
 			fp->flag = mode;	/* Set file access mode */
 			fp->err = 0;		/* Clear error flag */
 			fp->sect = 0;		/* Invalidate current data sector */
 			fp->fptr = 0;		/* Set file pointer top of the file */
+#if FF_FS_BUFPOOL
+			fp->buf = 0;		/* Sector buffer is borrowed on the first access */
+#endif
 #if !FF_FS_READONLY
-#if !FF_FS_TINY
+#if !FF_FS_TINY && !FF_FS_BUFPOOL
 			memset(fp->buf, 0, sizeof fp->buf);	/* Clear sector buffer */
 #endif
 			if ((mode & FA_SEEKEND) && fp->obj.objsize > 0) {	/* Seek to end of file if FA_OPEN_APPEND is specified */
 				DWORD bcs, clst;
 				FSIZE_t ofs;
+#if FF_FS_FCACHE
+				DWORD cl;
+#endif
 
 				fp->fptr = fp->obj.objsize;			/* Offset to seek */
 				bcs = (DWORD)fs->csize * SS(fs);	/* Cluster size in byte */
 				clst = fp->obj.sclust;				/* Follow the cluster chain */
-				for (ofs = fp->obj.objsize; res == FR_OK && ofs > bcs; ofs -= bcs) {
+				ofs = fp->obj.objsize;
+#if FF_FS_FCACHE
+				if ((cl = fc_find(fs, clst, ofs)) != 0) {	/* Take the last cluster from the cache if the file is known */
+					clst = cl;
+					ofs = (ofs - 1) % bcs + 1;
+				}
+#endif
+				for ( ; res == FR_OK && ofs > bcs; ofs -= bcs) {
 					clst = get_fat(&fp->obj, clst);
 					if (clst <= 1) res = FR_INT_ERR;
 					if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
@@ -3976,7 +5839,7 @@ FRESULT f_open (
 						res = FR_INT_ERR;
 					} else {
 						fp->sect = sec + (DWORD)(ofs / SS(fs));
-#if !FF_FS_TINY
+#if !FF_FS_TINY && !FF_FS_BUFPOOL	/* (The sector is loaded when a pool buffer is borrowed) */
 						if (disk_read(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) res = FR_DISK_ERR;
 #endif
 					}
@@ -4000,62 +5863,96 @@ FRESULT f_open (
 
 
 /*-----------------------------------------------------------------------*/
-/* API: Read File                                                        */
+/* Read File - Move to the cluster of the file pointer                   */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_read (
-	FIL* fp, 	/* Open file to be read */
-	void* buff,	/* Data buffer to store the read data */
-	UINT btr,	/* Number of bytes to read */
-	UINT* br	/* Number of bytes read */
+static FRESULT read_clust (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp		/* Pointer to the file object with fptr on the cluster boundary */
+)
+{
+	DWORD clst;
+#if FF_FS_EXTMAP
+	FATFS *fs = fp->obj.fs;
+#endif
+
+
+	if (fp->fptr == 0) {			/* On the top of the file? */
+		clst = fp->obj.sclust;		/* Follow cluster chain from the origin */
+	} else {						/* Middle or end of the file */
+#if FF_USE_FASTSEEK
+		if (fp->cltbl) {
+			clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+		} else
+#endif
+		{
+#if FF_FS_EXTMAP
+			clst = xmap_clust(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize));	/* Get cluster# from the cluster map */
+			if (clst == 0)
+#endif
+			{
+#if FF_FS_REENTRANT == 2
+				if (!lock_volume(fp->obj.fs, 0)) return FR_TIMEOUT;	/* Take the volume only while following the FAT */
+#endif
+				clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
+#if FF_FS_REENTRANT == 2
+				unlock_volume(fp->obj.fs, FR_OK);
+#endif
+			}
+		}
+	}
+	if (clst < 2) return FR_INT_ERR;
+	if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
+	fp->clust = clst;				/* Update current cluster */
+#if FF_FS_EXTMAP
+	xmap_add(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize), clst);
+#endif
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read File - Transfer the file data                                    */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT read_file (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object */
+	BYTE* rbuff,	/* Data buffer to store the read data */
+	UINT btr,		/* Number of bytes to read */
+	UINT* br		/* Number of bytes read */
 )
 {
 	FRESULT res;
-	FATFS *fs;
+	FATFS *fs = fp->obj.fs;
 	LBA_t sect;
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
-	BYTE *rbuff = (BYTE*)buff;
 
 
-	*br = 0;	/* Clear read byte counter */
-	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
-	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
-	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+	*br = 0;
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
+#if FF_FS_BUFPOOL
+	if (btr > 0 && get_pbuf(fp, 1) != FR_OK) return FR_DISK_ERR;	/* Borrow a sector buffer from the pool */
+#endif
 
 	for ( ; btr > 0; btr -= rcnt, *br += rcnt, rbuff += rcnt, fp->fptr += rcnt) {	/* Repeat until btr bytes read */
 		if (fp->fptr % SS(fs) == 0) {			/* On the sector boundary? */
 			csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
 			if (csect == 0) {					/* On the cluster boundary? */
-				DWORD clst;
-
-				if (fp->fptr == 0) {			/* On the top of the file? */
-					clst = fp->obj.sclust;		/* Follow cluster chain from the origin */
-				} else {						/* Middle or end of the file */
-#if FF_USE_FASTSEEK
-					if (fp->cltbl) {
-						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
-					} else
-#endif
-					{
-						clst = get_fat(&fp->obj, fp->clust);	/* Follow cluster chain on the FAT */
-					}
-				}
-				if (clst < 2) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-				fp->clust = clst;				/* Update current cluster */
+				res = read_clust(fp);			/* Move to the next cluster */
+				if (res != FR_OK) return res;
 			}
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
-			if (sect == 0) ABORT(fs, FR_INT_ERR);
+			if (sect == 0) return FR_INT_ERR;
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
-				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) return FR_DISK_ERR;
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -4073,12 +5970,19 @@ FRESULT f_read (
 #if !FF_FS_TINY
 			if (fp->sect != sect) {			/* Load data sector if not in cache */
 #if !FF_FS_READONLY
+#if FF_USE_FILEBUF
+				if (sync_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Write-back the write-behind buffer */
+#endif
 				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-					fp->flag &= (BYTE)~FA_DIRTY;
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+					CLR_DIRTY(fp);
 				}
 #endif
-				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+#if FF_USE_FILEBUF
+				if (fill_fbuf(fp, sect) != FR_OK) return FR_DISK_ERR;	/* Fill sector cache with read-ahead */
+#else
+				if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) return FR_DISK_ERR;	/* Fill sector cache */
+#endif
 			}
 #endif
 			fp->sect = sect;
@@ -4086,57 +5990,292 @@ FRESULT f_read (
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		if (move_window(fs, fp->sect) != FR_OK) return FR_DISK_ERR;	/* Move sector window */
 		memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #else
 		memcpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
-	}
+	}
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* API: Read File                                                        */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_read (
+	FIL* fp, 	/* Open file to be read */
+	void* buff,	/* Data buffer to store the read data */
+	UINT btr,	/* Number of bytes to read */
+	UINT* br	/* Number of bytes read */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	*br = 0;	/* Clear read byte counter */
+	res = validate_rd(fp, &fs);					/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_RD(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_READ)) LEAVE_RD(fs, FR_DENIED); /* Check access mode */
+#if FF_USE_FILEBUF
+#if !FF_FS_READONLY
+	if (flush_fbuf(fp) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Flush the write-behind buffer prior to read the file data */
+#endif
+	if (fp->fptr != fp->ra_pos) fp->ra_win = 0;	/* Stop read-ahead on a random access */
+#endif
+	res = read_file(fp, (BYTE*)buff, btr, br);	/* Transfer the data */
+	if (res != FR_OK) ABORT_RD(fs, res);
+#if FF_USE_FILEBUF
+	fp->ra_pos = fp->fptr;	/* Next read at here is sequential */
+#endif
+
+	LEAVE_RD(fs, FR_OK);
+}
+
+
+
+
+#if FF_USE_IOVEC
+/*-----------------------------------------------------------------------*/
+/* API: Read File into Multiple Buffers                                  */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_readv (
+	FIL* fp, 			/* Open file to be read */
+	const FFIOVEC* iov,	/* Array of the data buffers to store the read data */
+	UINT iovcnt,		/* Number of the data buffers */
+	UINT* br			/* Number of bytes read */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	UINT i, rcnt;
+
+
+	*br = 0;	/* Clear read byte counter */
+	res = validate_rd(fp, &fs);					/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_RD(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_READ)) LEAVE_RD(fs, FR_DENIED); /* Check access mode */
+#if FF_USE_FILEBUF
+#if !FF_FS_READONLY
+	if (flush_fbuf(fp) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Flush the write-behind buffer prior to read the file data */
+#endif
+	if (fp->fptr != fp->ra_pos) fp->ra_win = 0;	/* Stop read-ahead on a random access */
+#endif
+
+	for (i = 0; i < iovcnt; i++) {	/* Fill the buffers in order */
+		res = read_file(fp, (BYTE*)iov[i].buf, iov[i].len, &rcnt);
+		*br += rcnt;
+		if (res != FR_OK) ABORT_RD(fs, res);
+		if (rcnt < iov[i].len) break;	/* End of file */
+	}
+#if FF_USE_FILEBUF
+	fp->ra_pos = fp->fptr;	/* Next read at here is sequential */
+#endif
+
+	LEAVE_RD(fs, FR_OK);
+}
+
+#endif	/* FF_USE_IOVEC */
+
+
+
+
+#if FF_USE_READVIEW
+/*-----------------------------------------------------------------------*/
+/* API: Read File without Copy                                           */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_readview (
+	FIL* fp, 			/* Open file to be read */
+	const BYTE** ptr,	/* Pointer to return the pointer to the data in the file object */
+	UINT btr,			/* Maximum number of bytes to read */
+	UINT* br			/* Number of bytes available at *ptr */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	LBA_t sect;
+	FSIZE_t remain;
+	UINT rcnt, csect;
+	const BYTE *rp;
+
+
+	*br = 0; *ptr = 0;
+	res = validate_rd(fp, &fs);					/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_RD(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_READ)) LEAVE_RD(fs, FR_DENIED); /* Check access mode */
+#if FF_USE_FILEBUF
+#if !FF_FS_READONLY
+	if (flush_fbuf(fp) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Flush the write-behind buffer prior to read the file data */
+#endif
+	if (fp->fptr != fp->ra_pos) fp->ra_win = 0;	/* Stop read-ahead on a random access */
+#endif
+	remain = fp->obj.objsize - fp->fptr;
+	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
+	if (btr == 0) LEAVE_RD(fs, FR_OK);
+#if FF_FS_BUFPOOL
+	if (get_pbuf(fp, 1) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Borrow a sector buffer from the pool */
+#endif
+
+	rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
+	if (fp->fptr % SS(fs) == 0) {				/* On the sector boundary? */
+		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
+		if (csect == 0) {						/* On the cluster boundary? */
+			res = read_clust(fp);				/* Move to the next cluster */
+			if (res != FR_OK) ABORT_RD(fs, res);
+		}
+		sect = clst2sect(fs, fp->clust);		/* Get current sector */
+		if (sect == 0) ABORT_RD(fs, FR_INT_ERR);
+		sect += csect;
+#if !FF_FS_TINY
+		if (fp->sect != sect) {				/* Load data sector if not in cache */
+#if !FF_FS_READONLY
+#if FF_USE_FILEBUF
+			if (sync_fbuf(fp) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Write-back the write-behind buffer */
+#endif
+			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT_RD(fs, FR_DISK_ERR);
+				CLR_DIRTY(fp);
+			}
+#endif
+#if FF_USE_FILEBUF
+			if (sect - fp->ra_sect >= fp->ra_cnt) {	/* Fill sector cache with read-ahead if not read ahead yet */
+				if (fill_fbuf(fp, sect) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);
+			}
+			if (sect - fp->ra_sect < fp->ra_cnt) {	/* Give the read-ahead sectors up to the end of the cluster */
+				rp = fp->fb_buf + (sect - fp->ra_sect) * SS(fs);
+				csect = fs->csize - csect;
+				if (csect > fp->ra_sect + fp->ra_cnt - sect) csect = (UINT)(fp->ra_sect + fp->ra_cnt - sect);
+				rcnt = csect * SS(fs);
+				if (rcnt > btr) rcnt = btr;
+				fp->sect = 0;				/* buf[] is not filled */
+				sect += rcnt / SS(fs);
+				if (rcnt % SS(fs)) {		/* Leave the last sector in buf[] if the view ends in the middle of it */
+					memcpy(fp->buf, rp + rcnt / SS(fs) * SS(fs), SS(fs));
+					fp->sect = sect;
+				}
+				fp->fptr += rcnt;
+				*ptr = rp; *br = rcnt;
+				fp->ra_pos = fp->fptr;
+				LEAVE_RD(fs, FR_OK);
+			}
+#else
+			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Fill sector cache */
+#endif
+		}
+#endif
+		fp->sect = sect;
+	}
+	if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
+#if FF_FS_TINY
+	if (move_window(fs, fp->sect) != FR_OK) ABORT_RD(fs, FR_DISK_ERR);	/* Move sector window */
+	rp = fs->win + fp->fptr % SS(fs);
+#else
+	rp = fp->buf + fp->fptr % SS(fs);
+#endif
+	fp->fptr += rcnt;
+	*ptr = rp; *br = rcnt;
+#if FF_USE_FILEBUF
+	fp->ra_pos = fp->fptr;	/* Next read at here is sequential */
+#endif
+
+	LEAVE_RD(fs, FR_OK);
+}
+
+#endif	/* FF_USE_READVIEW */
+
+
+
+
+#if FF_USE_FILEBUF
+/*-----------------------------------------------------------------------*/
+/* API: Attach a Read-ahead/Write-behind Buffer to the File              */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_setbuf (
+	FIL* fp,		/* Open file to be buffered */
+	void* buf,		/* Buffer for the file data (null:Detach the buffer) */
+	UINT nsect		/* Size of the buffer in unit of sector */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (buf && nsect == 0) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+
+#if !FF_FS_READONLY
+	if (flush_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Flush the current buffer */
+#endif
+	fp->fb_buf = (BYTE*)buf;
+	fp->fb_size = buf ? nsect : 0;
+	fp->ra_win = 0; fp->ra_cnt = 0;
 
 	LEAVE_FF(fs, FR_OK);
 }
 
+#endif	/* FF_USE_FILEBUF */
+
 
 
 
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
-/* API: Write File                                                       */
+/* Write File - Transfer the file data                                   */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_write (
-	FIL* fp,			/* Open file to be written */
-	const void* buff,	/* Data to be written */
+static FRESULT write_file (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,			/* Pointer to the file object */
+	const BYTE* wbuff,	/* Data to be written */
 	UINT btw,			/* Number of bytes to write */
+	UINT btf,			/* Number of bytes to follow in the same transfer (hint for cluster allocation) */
+	DWORD* ecl,			/* Last cluster of the run allocated ahead in the same transfer (0:none) */
 	UINT* bw			/* Number of bytes written */
 )
 {
-	FRESULT res;
-	FATFS *fs;
+	FATFS *fs = fp->obj.fs;
 	DWORD clst;
+#if FF_FS_BULKALLOC
+	DWORD eprev;
+#endif
 	LBA_t sect;
 	UINT wcnt, cc, csect;
-	const BYTE *wbuff = (const BYTE*)buff;
 
 
-	*bw = 0;	/* Clear write byte counter */
-	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
-	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
-	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
-
+#if !FF_FS_BULKALLOC
+	(void)btf; (void)ecl;	/* Used only for the bulk allocation */
+#endif
+	*bw = 0;
 	/* Check fptr wrap-around (file size cannot reach 4 GiB at FAT volume) */
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
 		btw = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);
 	}
+#if FF_FS_BUFPOOL
+	if (btw > 0 && get_pbuf(fp, 1) != FR_OK) return FR_DISK_ERR;	/* Borrow a sector buffer from the pool */
+#endif
 
 	for ( ; btw > 0; btw -= wcnt, *bw += wcnt, wbuff += wcnt, fp->fptr += wcnt, fp->obj.objsize = (fp->fptr > fp->obj.objsize) ? fp->fptr : fp->obj.objsize) {	/* Repeat until all data written */
 		if (fp->fptr % SS(fs) == 0) {		/* On the sector boundary? */
 			csect = (UINT)(fp->fptr / SS(fs)) & (fs->csize - 1);	/* Sector offset in the cluster */
 			if (csect == 0) {				/* On the cluster boundary? */
+#if FF_FS_BULKALLOC
+				eprev = *ecl; *ecl = 0;		/* No run of clusters known ahead */
+#endif
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->obj.sclust;	/* Follow from the origin */
 					if (clst == 0) {		/* If no cluster is allocated, */
+#if FF_FS_BULKALLOC
+						clst = stretch_chain(&fp->obj, 0, (btw + btf - 1) / SS(fs) / fs->csize + 1, ecl);	/* create a new cluster chain for the data */
+#else
 						clst = create_chain(&fp->obj, 0);	/* create a new cluster chain */
+#endif
 					}
 				} else {					/* On the middle or end of the file */
 #if FF_USE_FASTSEEK
@@ -4145,32 +6284,66 @@ FRESULT f_write (
 					} else
 #endif
 					{
+#if FF_FS_EXTMAP
+						clst = xmap_clust(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize));	/* Get cluster# from the cluster map */
+						if (clst == 0)
+#endif
+#if FF_FS_BULKALLOC
+						clst = stretch_chain(&fp->obj, fp->clust, (btw + btf - 1) / SS(fs) / fs->csize + 1, ecl);	/* Follow or stretch cluster chain for the data */
+#else
 						clst = create_chain(&fp->obj, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+#endif
 					}
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
-				if (clst == 1) ABORT(fs, FR_INT_ERR);
-				if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+				if (clst == 1) return FR_INT_ERR;
+				if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
+#if FF_FS_BULKALLOC
+				if (fp->fptr != 0 && clst == fp->clust + 1 && eprev > *ecl) *ecl = eprev;	/* Still in the run allocated ahead for the former data */
+#endif
 				fp->clust = clst;			/* Update current cluster */
 				if (fp->obj.sclust == 0) fp->obj.sclust = clst;	/* Set start cluster if the first write */
+#if FF_FS_EXTMAP
+				xmap_add(fp, (DWORD)(fp->fptr / SS(fs) / fs->csize), clst);
+#endif
 			}
 #if FF_FS_TINY
-			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
+			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* Write-back sector cache */
 #else
+#if FF_USE_FILEBUF
+			if (fp->fb_size > 0 && (fp->flag & FA_DIRTY) && put_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Put the sector cache into the write-behind buffer */
+#endif
 			if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+				CLR_DIRTY(fp);
 			}
 #endif
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
-			if (sect == 0) ABORT(fs, FR_INT_ERR);
+			if (sect == 0) return FR_INT_ERR;
 			sect += csect;
 			cc = btw / SS(fs);				/* When remaining bytes >= sector size, */
 			if (cc > 0) {					/* Write maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
+#if FF_FS_BULKALLOC
+					if (*ecl > fp->clust) {		/* or at end of the run of clusters allocated */
+						if (cc > fs->csize - csect + (*ecl - fp->clust) * fs->csize) cc = fs->csize - csect + (*ecl - fp->clust) * fs->csize;
+					} else
+#endif
 					cc = fs->csize - csect;
 				}
-				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+#if FF_USE_FILEBUF
+				if (flush_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Keep the order of writes */
+				fp->ra_cnt = 0;		/* Discard the read-ahead data as it can be overwritten */
+#endif
+				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) return FR_DISK_ERR;
+#if FF_FS_BULKALLOC
+				for (clst = (DWORD)(fp->fptr / SS(fs) / fs->csize), csect += cc; csect > fs->csize; csect -= fs->csize) {	/* Move to the last cluster written */
+					fp->clust++;
+#if FF_FS_EXTMAP
+					xmap_add(fp, ++clst, fp->clust);
+#endif
+				}
+#endif
 #if FF_FS_MINIMIZE <= 2
 #if FF_FS_TINY
 				if (fs->winsect - sect < cc) {	/* Refill sector cache if it gets invalidated by the direct write */
@@ -4180,7 +6353,7 @@ FRESULT f_write (
 #else
 				if (fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
 					memcpy(fp->buf, wbuff + ((fp->sect - sect) * SS(fs)), SS(fs));
-					fp->flag &= (BYTE)~FA_DIRTY;
+					CLR_DIRTY(fp);
 				}
 #endif
 #endif
@@ -4189,14 +6362,17 @@ FRESULT f_write (
 			}
 #if FF_FS_TINY
 			if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
-				if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+				if (sync_window(fs) != FR_OK) return FR_DISK_ERR;
 				fs->winsect = sect;
 			}
 #else
+#if FF_USE_FILEBUF
+			if (sect - fp->fb_sect < fp->fb_cnt && flush_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Flush the write-behind buffer if it has the sector */
+#endif
 			if (fp->sect != sect && 		/* Fill sector cache with file data */
 				fp->fptr < fp->obj.objsize &&
 				disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) {
-					ABORT(fs, FR_DISK_ERR);
+					return FR_DISK_ERR;
 			}
 #endif
 			fp->sect = sect;
@@ -4204,20 +6380,178 @@ FRESULT f_write (
 		wcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (wcnt > btw) wcnt = btw;					/* Clip it by btw if needed */
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+		if (move_window(fs, fp->sect) != FR_OK) return FR_DISK_ERR;	/* Move sector window */
 		memcpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
 		fs->wflag = 1;
 #else
 		memcpy(fp->buf + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
-		fp->flag |= FA_DIRTY;
+		SET_DIRTY(fp);
 #endif
 	}
+#if FF_FS_BUFPOOL && FF_USE_FILEBUF
+	if (fp->fb_size > 0 && (fp->flag & FA_DIRTY) && put_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Keep the dirty data in the file buffer, not in the pool */
+#endif
 
 	fp->flag |= FA_MODIFIED;				/* Set file change flag */
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* API: Write File                                                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_write (
+	FIL* fp,			/* Open file to be written */
+	const void* buff,	/* Data to be written */
+	UINT btw,			/* Number of bytes to write */
+	UINT* bw			/* Number of bytes written */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD ecl = 0;
+
+
+	*bw = 0;	/* Clear write byte counter */
+	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+
+	res = write_file(fp, (const BYTE*)buff, btw, 0, &ecl, bw);	/* Transfer the data */
+	if (res != FR_OK) ABORT(fs, res);
+
+	LEAVE_FF(fs, FR_OK);
+}
+
+
+
+
+#if FF_USE_IOVEC
+/*-----------------------------------------------------------------------*/
+/* API: Write File from Multiple Buffers                                 */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_writev (
+	FIL* fp,			/* Open file to be written */
+	const FFIOVEC* iov,	/* Array of the data buffers to be written */
+	UINT iovcnt,		/* Number of the data buffers */
+	UINT* bw			/* Number of bytes written */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	UINT i, wcnt, btf;
+	DWORD ecl = 0;
+
+
+	*bw = 0;	/* Clear write byte counter */
+	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+
+	for (btf = 0, i = 0; i < iovcnt; i++) {	/* Number of bytes in the transfer (saturated) */
+		btf = (iov[i].len < (UINT)~0 - btf) ? btf + iov[i].len : (UINT)~0;
+	}
+	for (i = 0; i < iovcnt; i++) {	/* Write the buffers in order */
+		if (btf != (UINT)~0) btf -= iov[i].len;	/* Number of bytes to follow this buffer */
+		res = write_file(fp, (const BYTE*)iov[i].buf, iov[i].len, (btf < (UINT)~0 - iov[i].len) ? btf : (UINT)~0 - iov[i].len, &ecl, &wcnt);
+		*bw += wcnt;
+		if (res != FR_OK) ABORT(fs, res);
+		if (wcnt < iov[i].len) break;	/* Disk full */
+	}
 
 	LEAVE_FF(fs, FR_OK);
 }
 
+#endif	/* FF_USE_IOVEC */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Synchronize the File - Flush the cached data / Update the entry       */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT flush_file (	/* Returns FR_OK or FR_DISK_ERR */
+	FIL* fp		/* Pointer to the modified file object */
+)
+{
+#if !FF_FS_TINY
+#if FF_FS_BUFPOOL
+	chk_pbuf(fp);	/* Drop the buffer lent to another file (its data has been written back) */
+#endif
+#if FF_USE_FILEBUF
+	if (sync_fbuf(fp) != FR_OK) return FR_DISK_ERR;	/* Write-back the write-behind buffer in a multi-sector transfer */
+#endif
+	if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
+		if (disk_write(fp->obj.fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) return FR_DISK_ERR;
+		CLR_DIRTY(fp);
+	}
+#else
+	(void)fp;	/* File data is written back with the window */
+#endif
+	return FR_OK;
+}
+
+
+static FRESULT update_entry (	/* FR_OK:Succeeded, !=0:Error (the entry is left in the window) */
+	FIL* fp		/* Pointer to the modified file object */
+)
+{
+	FRESULT res;
+	FATFS *fs = fp->obj.fs;
+
+
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		res = fill_first_frag(&fp->obj);	/* Fill first fragment on the FAT if needed */
+		if (res == FR_OK) {
+			res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
+		}
+		if (res == FR_OK) {
+			DIR dj;
+			DEF_NAMEBUFF
+
+			INIT_NAMEBUFF(fs);
+			res = load_obj_xdir(&dj, &fp->obj);	/* Load directory entry block */
+			if (res == FR_OK) {
+				fs->dirbuf[XDIR_Attr] |= AM_ARC;					/* Set archive attribute to indicate that the file has been changed */
+				fs->dirbuf[XDIR_GenFlags] = fp->obj.stat | 1;		/* Update file allocation information */
+				st_32(fs->dirbuf + XDIR_FstClus, fp->obj.sclust);	/* Update start cluster */
+				st_64(fs->dirbuf + XDIR_FileSize, fp->obj.objsize);	/* Update file size */
+				st_64(fs->dirbuf + XDIR_ValidFileSize, fp->obj.objsize);	/* (FatFs does not support Valid File Size feature) */
+				st_32(fs->dirbuf + XDIR_ModTime, GET_FATTIME());	/* Update modified time */
+				fs->dirbuf[XDIR_ModTime10] = 0;
+				fs->dirbuf[XDIR_ModTZ] = 0;
+				st_32(fs->dirbuf + XDIR_AccTime, 0);				/* Invalidate last access time */
+				fs->dirbuf[XDIR_AccTZ] = 0;
+				res = store_xdir(&dj);								/* Restore it to the directory */
+				if (res == FR_OK) fp->flag &= (BYTE)~FA_MODIFIED;
+			}
+			FREE_NAMEBUFF();
+		}
+	} else
+#endif
+	{
+		res = move_window(fs, fp->dir_sect);
+		if (res == FR_OK) {
+			BYTE *dir = fp->dir_ptr;
+
+			dir[DIR_Attr] |= AM_ARC;					/* Set archive attribute to indicate that the file has been changed */
+			st_clust(fp->obj.fs, dir, fp->obj.sclust);	/* Update file allocation information  */
+			st_32(dir + DIR_FileSize, (DWORD)fp->obj.objsize);	/* Update file size */
+			st_32(dir + DIR_ModTime, GET_FATTIME());	/* Update modified time */
+			st_16(dir + DIR_LstAccDate, 0);				/* Invalidate last access date */
+			fs->wflag = 1;
+			fp->flag &= (BYTE)~FA_MODIFIED;
+		}
+	}
+	return res;
+}
+
 
 
 
@@ -4236,67 +6570,129 @@ FRESULT f_sync (
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res == FR_OK) {
 		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
-#if !FF_FS_TINY
-			if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+			res = flush_file(fp);
+			if (res == FR_OK) res = update_entry(fp);	/* Update the directory entry */
+			if (res == FR_OK) res = sync_fs(fs);		/* Restore it to the directory */
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+#if FF_USE_SYNCV
+/*-----------------------------------------------------------------------*/
+/* API: Synchronize a Group of Files at a Time                           */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT sync_files (	/* FR_OK, error code of a file in hard error or error of the sync */
+	FATFS* fs,			/* Filesystem object (locked) */
+	FIL* const fps[],	/* Open files to be synced */
+	UINT nf				/* Number of files */
+)
+{
+	FRESULT res, ferr = FR_OK;
+	FIL *fp;
+	UINT i;
+	int mod = 0;
+
+
+	for (i = 0; i < nf; i++) {	/* Flush the cached data of each modified file */
+		if (fps[i]->err) {		/* Skip the file in hard error */
+			if (ferr == FR_OK) ferr = (FRESULT)fps[i]->err;
+			continue;
+		}
+		if (fps[i]->flag & FA_MODIFIED) {
+			res = flush_file(fps[i]);
+			if (res != FR_OK) return res;
+			mod = 1;
+		}
+	}
+	if (mod) {
+		for (;;) {	/* Update the directory entries in ascending order of sector, so that each directory sector is written once */
+			fp = 0;
+			for (i = 0; i < nf; i++) {
+				if (!fps[i]->err && (fps[i]->flag & FA_MODIFIED) && (!fp || fps[i]->dir_sect < fp->dir_sect)) fp = fps[i];
 			}
+			if (!fp) break;
+			res = update_entry(fp);
+			if (res != FR_OK) return res;
+		}
+		res = sync_fs(fs);	/* Write back the directory and FAT sectors, and FSINFO at a time */
+		if (res != FR_OK) return res;
+	}
+	return ferr;
+}
+
+
+#if FF_FS_REENTRANT == 2
+static UINT next_lockid (	/* Smallest lock ID of the files above lid (0:no more) */
+	FIL* const fps[],	/* Open files */
+	UINT nf,			/* Number of files */
+	UINT lid			/* Lock ID to start after */
+)
+{
+	UINT i, nlid = 0;
+
+
+	for (i = 0; i < nf; i++) {
+		if (fps[i]->obj.lockid > lid && (nlid == 0 || fps[i]->obj.lockid < nlid)) nlid = fps[i]->obj.lockid;
+	}
+	return nlid;
+}
 #endif
-			/* Update the directory entry */
-#if FF_FS_EXFAT
-			if (fs->fs_type == FS_EXFAT) {
-				res = fill_first_frag(&fp->obj);	/* Fill first fragment on the FAT if needed */
-				if (res == FR_OK) {
-					res = fill_last_frag(&fp->obj, fp->clust, 0xFFFFFFFF);	/* Fill last fragment on the FAT if needed */
-				}
-				if (res == FR_OK) {
-					DIR dj;
-					DEF_NAMEBUFF
 
-					INIT_NAMEBUFF(fs);
-					res = load_obj_xdir(&dj, &fp->obj);	/* Load directory entry block */
-					if (res == FR_OK) {
-						fs->dirbuf[XDIR_Attr] |= AM_ARC;					/* Set archive attribute to indicate that the file has been changed */
-						fs->dirbuf[XDIR_GenFlags] = fp->obj.stat | 1;		/* Update file allocation information */
-						st_32(fs->dirbuf + XDIR_FstClus, fp->obj.sclust);	/* Update start cluster */
-						st_64(fs->dirbuf + XDIR_FileSize, fp->obj.objsize);	/* Update file size */
-						st_64(fs->dirbuf + XDIR_ValidFileSize, fp->obj.objsize);	/* (FatFs does not support Valid File Size feature) */
-						st_32(fs->dirbuf + XDIR_ModTime, GET_FATTIME());	/* Update modified time */
-						fs->dirbuf[XDIR_ModTime10] = 0;
-						fs->dirbuf[XDIR_ModTZ] = 0;
-						st_32(fs->dirbuf + XDIR_AccTime, 0);				/* Invalidate last access time */
-						fs->dirbuf[XDIR_AccTZ] = 0;
-						res = store_xdir(&dj);								/* Restore it to the directory */
-						if (res == FR_OK) {
-							res = sync_fs(fs);
-							fp->flag &= (BYTE)~FA_MODIFIED;
-						}
-					}
-					FREE_NAMEBUFF();
-				}
-			} else
+
+FRESULT f_syncv (
+	FIL* const fps[],	/* Open files to be synced (all on the same volume) */
+	UINT nf				/* Number of files */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	UINT i;
+#if FF_FS_REENTRANT == 2
+	UINT lid, nlid;
 #endif
-			{
-				res = move_window(fs, fp->dir_sect);
-				if (res == FR_OK) {
-					BYTE *dir = fp->dir_ptr;
 
-					dir[DIR_Attr] |= AM_ARC;					/* Set archive attribute to indicate that the file has been changed */
-					st_clust(fp->obj.fs, dir, fp->obj.sclust);	/* Update file allocation information  */
-					st_32(dir + DIR_FileSize, (DWORD)fp->obj.objsize);	/* Update file size */
-					st_32(dir + DIR_ModTime, GET_FATTIME());	/* Update modified time */
-					st_16(dir + DIR_LstAccDate, 0);				/* Invalidate last access date */
-					fs->wflag = 1;
-					res = sync_fs(fs);							/* Restore it to the directory */
-					fp->flag &= (BYTE)~FA_MODIFIED;
-				}
-			}
-		}
+
+	if (nf == 0) return FR_OK;
+#if FF_FS_REENTRANT == 2
+	fs = fps[0]->obj.fs;
+	for (i = 0; i < nf; i++) {	/* Check validity of the file objects */
+		if (!fs || !fs->fs_type || fps[i]->obj.fs != fs || fps[i]->obj.id != fs->id) return FR_INVALID_OBJECT;
+	}
+	for (lid = 0; (nlid = next_lockid(fps, nf, lid)) != 0 && ff_mutex_take(FF_VOLUMES + nlid); lid = nlid) ;	/* Take the object locks in ascending order of lock ID prior to the volume lock */
+	res = FR_TIMEOUT;
+	if (nlid == 0 && lock_volume(fs, 0)) {
+		fs->olock = 0;	/* The object locks are released here */
+		res = (fps[0]->obj.id == fs->id && !(disk_status(fs->pdrv) & STA_NOINIT)) ? FR_OK : FR_INVALID_OBJECT;	/* Test if the volume is still valid */
+		if (res == FR_OK) res = sync_files(fs, fps, nf);
+		unlock_volume(fs, FR_OK);
+	}
+	for (nlid = 0; (nlid = next_lockid(fps, nf, nlid)) != 0 && nlid <= lid; ) {	/* Release the object locks taken */
+		ff_mutex_give(FF_VOLUMES + nlid);
+	}
+	return res;
+#else
+	res = validate(&fps[0]->obj, &fs);	/* Check validity of the file objects */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+	for (i = 1; i < nf; i++) {
+		if (fps[i]->obj.fs != fs || fps[i]->obj.id != fs->id) LEAVE_FF(fs, FR_INVALID_OBJECT);
 	}
+	res = sync_files(fs, fps, nf);
 
 	LEAVE_FF(fs, res);
+#endif
 }
 
+#endif	/* FF_USE_SYNCV */
+
+
+
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -4320,6 +6716,13 @@ FRESULT f_close (
 	{
 		res = validate(&fp->obj, &fs);	/* Lock volume */
 		if (res == FR_OK) {
+#if FF_FS_FCACHE && !FF_FS_READONLY
+			if (!fp->err && fp->obj.objsize > 0 && fp->fptr == fp->obj.objsize && fp->clust >= 2) fc_put(fp);	/* Record the last cluster for appending */
+#endif
+#if FF_FS_BUFPOOL
+			chk_pbuf(fp);
+			if (fp->buf) fs->pbtkt[PB_SLOT(fp)] = 0;	/* Return the sector buffer to the pool */
+#endif
 #if FF_FS_LOCK
 			res = dec_share(fp->obj.lockid);		/* Decrement file open counter */
 			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
@@ -4570,6 +6973,9 @@ FRESULT f_lseek (
 	FRESULT res;
 	FATFS *fs;
 	DWORD clst, bcs;
+#if FF_FS_EXTMAP
+	DWORD cl;
+#endif
 	LBA_t nsect;
 	FSIZE_t ifptr;
 
@@ -4623,11 +7029,17 @@ FRESULT f_lseek (
 				if (dsc == 0) ABORT(fs, FR_INT_ERR);
 				dsc += (DWORD)((ofs - 1) / SS(fs)) & (fs->csize - 1);
 				if (fp->fptr % SS(fs) && dsc != fp->sect) {	/* Refill sector cache if needed */
+#if FF_FS_BUFPOOL
+					if (get_pbuf(fp, 0) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Borrow a sector buffer from the pool */
+#endif
 #if !FF_FS_TINY
 #if !FF_FS_READONLY
+#if FF_USE_FILEBUF
+					if (sync_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back the write-behind buffer */
+#endif
 					if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
 						if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-						fp->flag &= (BYTE)~FA_DIRTY;
+						CLR_DIRTY(fp);
 					}
 #endif
 					if (disk_read(fs->pdrv, fp->buf, dsc, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Load current sector */
@@ -4669,6 +7081,17 @@ FRESULT f_lseek (
 				fp->clust = clst;
 			}
 			if (clst != 0) {
+#if FF_FS_EXTMAP
+				xmap_add(fp, (DWORD)(fp->fptr / bcs), clst);
+				cl = (DWORD)((fp->fptr + ofs - 1) / bcs);	/* Cluster order of the destination */
+				if (cl >= fp->xm_ncl) cl = fp->xm_ncl - 1;	/* Last mapped cluster if beyond the map */
+				if (fp->xm_ncl > 0 && cl > fp->fptr / bcs) {	/* Skip the mapped part without following the chain */
+					clst = xmap_clust(fp, cl);
+					ofs -= (FSIZE_t)cl * bcs - fp->fptr;
+					fp->fptr = (FSIZE_t)cl * bcs;
+					fp->clust = clst;
+				}
+#endif
 				while (ofs > bcs) {						/* Cluster following loop */
 					ofs -= bcs; fp->fptr += bcs;
 #if !FF_FS_READONLY
@@ -4689,6 +7112,9 @@ FRESULT f_lseek (
 					if (clst == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
 					fp->clust = clst;
+#if FF_FS_EXTMAP
+					xmap_add(fp, (DWORD)(fp->fptr / bcs), clst);
+#endif
 				}
 				fp->fptr += ofs;
 				if (ofs % SS(fs)) {
@@ -4703,11 +7129,17 @@ FRESULT f_lseek (
 			fp->flag |= FA_MODIFIED;
 		}
 		if (fp->fptr % SS(fs) && nsect != fp->sect) {	/* Fill sector cache if needed */
+#if FF_FS_BUFPOOL
+			if (get_pbuf(fp, 0) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Borrow a sector buffer from the pool */
+#endif
 #if !FF_FS_TINY
 #if !FF_FS_READONLY
+#if FF_USE_FILEBUF
+			if (sync_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back the write-behind buffer */
+#endif
 			if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
 				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+				CLR_DIRTY(fp);
 			}
 #endif
 			if (disk_read(fs->pdrv, fp->buf, nsect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
@@ -4955,8 +7387,10 @@ FRESULT f_getfree (
 	FRESULT res;
 	FATFS *fs;
 	DWORD nfree, clst, stat;
+#if !FF_FS_FATSCAN || FF_FS_EXFAT
 	LBA_t sect;
 	UINT i;
+#endif
 	FFOBJID obj;
 
 
@@ -4971,7 +7405,11 @@ FRESULT f_getfree (
 		} else {
 			/* Scan FAT to obtain the correct free cluster count */
 			nfree = 0;
+#if FF_FS_FATRAM && !FF_FS_FATSCAN
+			if (fs->fs_type == FS_FAT12 || fs->fatram) {	/* FAT12 or FAT in the memory: Scan FAT entries with get_fat */
+#else
 			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
+#endif
 				clst = 2; obj.fs = fs;
 				do {
 					stat = get_fat(&obj, clst);
@@ -5005,6 +7443,11 @@ FRESULT f_getfree (
 					} while (clst);
 				} else
 #endif
+#if FF_FS_FATSCAN
+				{	/* FAT16/32: Scan 32 entries at a time in multi-sector reads */
+					res = scan_fat(fs, &nfree, 0);
+				}
+#else
 				{	/* FAT16/32: Scan WORD/DWORD FAT entries */
 					clst = fs->n_fatent;	/* Number of entries */
 					sect = fs->fatbase;		/* Top of the FAT */
@@ -5024,6 +7467,7 @@ FRESULT f_getfree (
 						i %= SS(fs);
 					} while (--clst);
 				}
+#endif
 			}
 			if (res == FR_OK) {		/* Update parameters if succeeded */
 				*nclst = nfree;			/* Return the free clusters */
@@ -5058,6 +7502,10 @@ FRESULT f_truncate (
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
 
 	if (fp->fptr < fp->obj.objsize) {	/* Process when fptr is not on the eof */
+#if FF_USE_FILEBUF
+		if (flush_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Flush the write-behind buffer before the clusters are freed */
+		fp->ra_cnt = 0;
+#endif
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
 			res = remove_chain(&fp->obj, fp->obj.sclust, 0);
 			fp->obj.sclust = 0;
@@ -5072,12 +7520,18 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
 		fp->flag |= FA_MODIFIED;
+#if FF_FS_EXTMAP
+		xmap_trim(fp, (DWORD)((fp->fptr + (FSIZE_t)fs->csize * SS(fs) - 1) / SS(fs) / fs->csize));	/* Drop the removed clusters from the map */
+#endif
 #if !FF_FS_TINY
+#if FF_FS_BUFPOOL
+		chk_pbuf(fp);
+#endif
 		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
 				res = FR_DISK_ERR;
 			} else {
-				fp->flag &= (BYTE)~FA_DIRTY;
+				CLR_DIRTY(fp);
 			}
 		}
 #endif
@@ -5168,6 +7622,9 @@ FRESULT f_unlink (
 				res = remove_chain(&dj.obj, dclst, 0);
 #endif
 			}
+#if FF_FS_DIRINDEX
+			if (res == FR_OK && (dj.obj.attr & AM_DIR)) dx_drop(fs, dclst);	/* Discard the index of the removed directory */
+#endif
 			if (res == FR_OK) res = sync_fs(fs);
 		}
 		FREE_NAMEBUFF();
@@ -5769,6 +8226,23 @@ FRESULT f_expand (
 			}
 		}
 	} else
+#endif
+#if FF_FS_FREEMAP
+	if (fs->freemap) {
+		scl = find_freemap(fs, stcl, tcl);			/* Find a contiguous cluster block on the bitmap */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+		if (res == FR_OK) {	/* A contiguous free area is found */
+			if (opt) {		/* Allocate it now */
+				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+					if (res != FR_OK) break;
+					lclst = clst;
+				}
+			} else {		/* Set it as suggested point for next allocation */
+				lclst = scl - 1;
+			}
+		}
+	} else
 #endif
 	{
 		scl = clst = stcl; ncl = 0;
@@ -5810,6 +8284,10 @@ FRESULT f_expand (
 			fp->obj.objsize = fsz;
 			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
 			fp->flag |= FA_MODIFIED;
+#if FF_FS_EXTMAP
+			fp->xm_cnt = 1; fp->xm_ncl = tcl;	/* The map is a single extent */
+			fp->xm_ofs[0] = 0; fp->xm_clst[0] = scl;
+#endif
 			if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
@@ -5849,9 +8327,15 @@ FRESULT f_forward (
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+#if FF_USE_FILEBUF && !FF_FS_READONLY
+	if (flush_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Flush the write-behind buffer prior to read the file data */
+#endif
 
 	remain = fp->obj.objsize - fp->fptr;
 	if (btf > remain) btf = (UINT)remain;			/* Truncate btf by remaining bytes */
+#if FF_FS_BUFPOOL
+	if (btf > 0 && get_pbuf(fp, 1) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Borrow a sector buffer from the pool */
+#endif
 
 	for ( ; btf > 0 && (*func)(0, 0); fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {	/* Repeat until all data transferred or stream goes busy */
 		csect = (UINT)(fp->fptr / SS(fs) & (fs->csize - 1));	/* Sector offset in the cluster */
@@ -5873,9 +8357,12 @@ FRESULT f_forward (
 #else
 		if (fp->sect != sect) {		/* Fill sector cache with file data */
 #if !FF_FS_READONLY
+#if FF_USE_FILEBUF
+			if (sync_fbuf(fp) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back the write-behind buffer */
+#endif
 			if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
 				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
+				CLR_DIRTY(fp);
 			}
 #endif
 			if (disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
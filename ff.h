@@ -145,6 +145,39 @@ typedef struct {
 #endif
 
 
+/* Path cache entry (FFDCENT) */
+
+#if FF_FS_DCACHE
+typedef struct {
+	DWORD	use;		/* Last access (0:empty) */
+	DWORD	dclst;		/* Start cluster of the directory holding the object (0:root dir) */
+	DWORD	dptr;		/* Offset of the SFN entry in the directory */
+	DWORD	clust;		/* Cluster holding the SFN entry */
+	LBA_t	sect;		/* Sector holding the SFN entry */
+	DWORD	sclust;		/* Start cluster of the object */
+#if FF_USE_LFN
+	DWORD	blk_ofs;	/* Offset of the entry block (0xFFFFFFFF:no LFN) */
+	WCHAR	name[32];	/* Object name (null-terminated) */
+#else
+	BYTE	name[11];	/* Object name in SFN format */
+#endif
+	BYTE	attr;		/* Object attribute */
+} FFDCENT;
+#endif
+
+
+/* Last cluster cache entry (FFFCENT) */
+
+#if FF_FS_FCACHE && !FF_FS_READONLY
+typedef struct {
+	DWORD	use;		/* Last access (0:empty) */
+	DWORD	sclust;		/* Start cluster of the file */
+	FSIZE_t	objsize;	/* File size when the entry was recorded */
+	DWORD	lclust;		/* Last cluster of the file */
+} FFFCENT;
+#endif
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -157,6 +190,9 @@ typedef struct {
 	WORD	id;			/* Volume mount ID */
 	WORD	n_rootdir;	/* Number of root directory entries (FAT12/16) */
 	WORD	csize;		/* Cluster size [sectors] */
+#if FF_FS_REENTRANT == 2
+	UINT	olock;		/* Object lock taken with the volume lock (lock ID of the object, 0:none) */
+#endif
 #if FF_MAX_SS != FF_MIN_SS
 	WORD	ssize;		/* Sector size (512, 1024, 2048 or 4096) */
 #endif
@@ -186,6 +222,43 @@ typedef struct {
 #endif
 #endif
 	BYTE	win[FF_MAX_SS];	/* Disk access window for directory, FAT (and file data in tiny cfg) */
+#if FF_FS_FATRAM
+	BYTE*	fatram;		/* In-memory copy of the FAT (null:not loaded) */
+	BYTE*	fatdirty;	/* Modified FAT sector bitmap (next to the FAT copy) */
+#endif
+#if FF_FS_LAZYFAT2 && !FF_FS_READONLY
+	BYTE*	fat2dirty;	/* Bitmap of the FAT sectors not reflected to the 2nd FAT yet (null:reflect immediately) */
+#endif
+#if FF_FS_FREEMAP
+	DWORD*	freemap;	/* Cluster usage bitmap, 1 bit per cluster (b0 of [0]:cluster 0, 1:in use) (null:not built) */
+#endif
+#if FF_FS_DIRINDEX
+	DWORD	dxclst[FF_FS_DIRINDEX];	/* Start cluster of the indexed directories (most recently used first) */
+	DWORD*	dxtbl[FF_FS_DIRINDEX];	/* Name hash index of each directory (null:not used) */
+#endif
+#if FF_FS_DCACHE
+	DWORD	dctick;		/* Path cache access counter */
+	FFDCENT	dcent[FF_FS_DCACHE];	/* Path cache */
+#endif
+#if FF_FS_FCACHE && !FF_FS_READONLY
+	DWORD	fctick;		/* Last cluster cache access counter */
+	FFFCENT	fcent[FF_FS_FCACHE];	/* Last cluster cache */
+#endif
+#if FF_WIN_CACHE
+	DWORD	wctick;		/* Window cache access counter */
+	DWORD	wcuse[FF_WIN_CACHE];	/* Last access of each cache slot (0:empty) */
+	LBA_t	wcsect[FF_WIN_CACHE];	/* Sector held in each cache slot */
+	BYTE	wcflag[FF_WIN_CACHE];	/* Status of each cache slot (b0:dirty) */
+	BYTE	wcbuf[FF_WIN_CACHE][FF_MAX_SS];	/* Sectors moved out of the win[] */
+#endif
+#if FF_FS_BUFPOOL
+	DWORD	pbtick;		/* Buffer pool access counter */
+	DWORD	pbuse[FF_FS_BUFPOOL];	/* Last access of each pool buffer */
+	DWORD	pbtkt[FF_FS_BUFPOOL];	/* Ticket of the current lending of each pool buffer (0:free) */
+	LBA_t	pbsect[FF_FS_BUFPOOL];	/* Sector number of the dirty data in each pool buffer */
+	BYTE	pbflag[FF_FS_BUFPOOL];	/* Dirty flag of each pool buffer (1:needs to be written-back) */
+	BYTE	pbbuf[FF_FS_BUFPOOL][FF_MAX_SS];	/* Sector buffers lent to the file objects */
+#endif
 } FATFS;
 
 
@@ -229,7 +302,28 @@ typedef struct {
 #if FF_USE_FASTSEEK
 	DWORD*	cltbl;		/* Pointer to the cluster link map table (nulled on open; set by application) */
 #endif
-#if !FF_FS_TINY
+#if FF_FS_EXTMAP
+	UINT	xm_cnt;		/* Number of extents in the cluster map */
+	DWORD	xm_ncl;		/* Number of clusters from top of the file covered by the map */
+	DWORD	xm_ofs[FF_FS_EXTMAP];	/* Cluster order from top of the file of each extent */
+	DWORD	xm_clst[FF_FS_EXTMAP];	/* Cluster number of each extent */
+#endif
+#if FF_USE_FILEBUF
+	BYTE*	fb_buf;		/* Pointer to the file buffer (set by application) */
+	UINT	fb_size;	/* Size of the file buffer in unit of sector (0:not attached) */
+	FSIZE_t	ra_pos;		/* File offset next to the last read to detect sequential access */
+	UINT	ra_win;		/* Number of sectors to be read ahead (0:random access) */
+	UINT	ra_cnt;		/* Number of sectors read ahead in the file buffer */
+	LBA_t	ra_sect;	/* Sector number of the top of the read-ahead sectors */
+#if !FF_FS_READONLY
+	UINT	fb_cnt;		/* Number of sectors collected in the file buffer for write-behind */
+	LBA_t	fb_sect;	/* Sector number of the top of the collected run */
+#endif
+#endif
+#if FF_FS_BUFPOOL
+	BYTE*	buf;		/* File private data read/write window borrowed from the pool (null:not borrowed) */
+	DWORD	pbtkt;		/* Ticket of the pool buffer lending (the buffer is lost if it differs from the pool's) */
+#elif !FF_FS_TINY
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
 #endif
 } FIL;
@@ -276,6 +370,15 @@ typedef struct {
 
 
 
+/* Data buffer descriptor (FFIOVEC) used for f_readv() and f_writev() */
+
+typedef struct {
+	void*	buf;			/* Pointer to the data buffer */
+	UINT	len;			/* Number of bytes in the buffer */
+} FFIOVEC;
+
+
+
 /* Format parameter structure (MKFS_PARM) used for f_mkfs() */
 
 typedef struct {
@@ -323,10 +426,14 @@ typedef enum {
 FRESULT f_open (FIL* fp, const TCHAR* path, BYTE mode);				/* Open or create a file */
 FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);			/* Read data from the file */
+FRESULT f_readv (FIL* fp, const FFIOVEC* iov, UINT iovcnt, UINT* br);	/* Read data from the file into multiple buffers */
+FRESULT f_readview (FIL* fp, const BYTE** ptr, UINT btr, UINT* br);	/* Read data from the file without copy */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to the file */
+FRESULT f_writev (FIL* fp, const FFIOVEC* iov, UINT iovcnt, UINT* bw);	/* Write data to the file from multiple buffers */
 FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of the file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate the file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of the writing file */
+FRESULT f_syncv (FIL* const fps[], UINT nf);						/* Flush cached data of the writing files at a time */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
@@ -346,6 +453,7 @@ FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_setbuf (FIL* fp, void* buf, UINT nsect);					/* Attach a read-ahead/write-behind buffer to the file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
@@ -390,7 +498,7 @@ DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 
 /* O/S dependent functions (samples available in ffsystem.c) */
 
-#if FF_USE_LFN == 3		/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_FS_FATRAM || FF_FS_FREEMAP || FF_FS_FATSCAN || FF_FS_DIRINDEX || FF_FS_LAZYFAT2	/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);		/* Allocate memory block */
 void ff_memfree (void* mblock);		/* Free memory block */
 #endif
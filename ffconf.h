@@ -178,7 +178,7 @@
 / Drive/Volume Configurations
 /---------------------------------------------------------------------------*/
 
-#define FF_VOLUMES		1
+#define FF_VOLUMES		4
 /* Number of volumes (logical drives) to be used. (1-10) */
 
 
@@ -231,6 +231,14 @@
 /  the disk_ioctl(). */
 
 
+#define FF_USE_ZERO		1
+/* This option switches clearing new directory clusters with the CTRL_ZERO
+/  command of disk_ioctl(). (0:Disable or 1:Enable) The device fills the range of
+/  sectors given in the same form as CTRL_TRIM with zeros, e.g. by an erase
+/  command or multi-sector writes. If the command fails, the cluster is cleared
+/  with disk_write() as when disabled. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -243,6 +251,171 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+#define FF_FS_BUFPOOL	0
+/* This option switches the sector buffer pool of file objects. (0:Disable or
+/  >0:Number of buffers) When enabled, the file object (FIL) has no private sector
+/  buffer and borrows one from the pool in the filesystem object (FATFS) when the
+/  file data is accessed. A file object that has no buffer takes a free one, or else
+/  the least recently used clean one, or else the least recently used dirty one
+/  after writing it back. The pool keeps the owner and the dirty state of each
+/  buffer by itself, never refers to the file object, and the holder finds the loss
+/  at its next access. The buffer is returned at f_close() or the volume remount. So
+/  the memory grows with the number of active files rather than the number of open
+/  files. The data returned by f_readview() is valid until the next file function
+/  on the volume.
+/  It cannot be used with the tiny buffer configuration or FF_FS_REENTRANT == 2. */
+
+
+#define FF_WIN_CACHE	4
+/* This option sets the number of extra sector buffers in the filesystem object
+/  (FATFS) that cache FAT and directory sectors moved out of the window. (0-16)
+/  When alternating FAT and directory accesses, the sectors are swapped with the
+/  window without disk access, and dirty sectors are written back in ascending
+/  LBA order at sync. Each buffer takes FF_MAX_SS + 12 bytes. It cannot be used
+/  with the tiny buffer configuration. */
+
+
+#define FF_FS_FATRAM	0
+/* This option switches loading the whole FAT into the memory at mount. (0:Disable
+/  or 1-1048576:Maximum size of the FAT to be loaded in unit of KiB) When enabled,
+/  the FAT of a FAT12/16/32 volume not larger than this size is read with a multi-
+/  sector read into a block taken by ff_memalloc() and FAT lookups and updates are
+/  done in the memory. Modified FAT sectors are written back in contiguous runs at
+/  sync. If the FAT is larger, the memory cannot be allocated or the FAT cannot be
+/  read, the volume is mounted without it. Note that the mount takes as long as
+/  reading the whole FAT. */
+
+
+#define FF_FS_FREEMAP	0
+/* This option switches the free cluster bitmap of FAT12/16/32 volumes. (0:Disable
+/  or 1:Enable) When enabled, a bitmap of cluster usage is built from the FAT at
+/  mount in a block taken by ff_memalloc(), and free clusters and contiguous free
+/  blocks are found on it a word at a time instead of reading the FAT entries.
+/  The number of free clusters is also counted at mount. Note that the mount reads
+/  the whole FAT, an entry at a time on the FAT12 volume or at FF_FS_FATSCAN == 0.
+/  Broken FAT entries are taken as in use. If the memory cannot be allocated or
+/  the FAT cannot be read, the volume is mounted without it. */
+
+
+#define FF_FS_FATSCAN	1
+/* This option switches the bulk scan of FAT16/32 volumes. (0:Disable or 1:Enable)
+/  When enabled, full FAT scans of f_getfree() and the free cluster bitmap read
+/  the FAT in multi-sector reads into a block taken by ff_memalloc() and test 32
+/  entries at a time with SSE2/AVX2/NEON instructions when the compiler targets
+/  them, or with portable code. FAT12 volumes are scanned entry by entry. */
+
+
+#define FF_FS_EXTMAP	8
+/* This option sets the number of extents in the cluster map of each file object
+/  (FIL). (0:Disable or 1-255) When enabled, the clusters of a file are recorded as
+/  contiguous extents while the cluster chain is followed by f_read(), f_write() and
+/  f_lseek(), and later accesses to the mapped part are resolved by a binary search
+/  without FAT access. The map is trimmed by f_truncate(). When it is full, the part
+/  of the file past the last extent is followed on the FAT. Each extent takes 8
+/  bytes. It is not used while the application's fast seek table is active. */
+
+
+#define FF_FS_BULKALLOC	1
+/* This option switches the bulk cluster allocation of f_write(). (0:Disable or
+/  1:Enable) When enabled, a write that crosses the end of the cluster chain of a
+/  FAT12/16/32 file allocates the clusters for the rest of the data at once. The
+/  first one is found as usual and the free clusters following it are linked in
+/  a pass over the FAT entries, and the data is written with a multi-sector write
+/  per contiguous run of clusters instead of per cluster. */
+
+
+#define FF_FS_DIRINDEX	4
+/* This option sets the number of directories that have a name hash index in the
+/  filesystem object (FATFS). (0:Disable or 1-16) When enabled, a directory on the
+/  FAT12/16/32 volume that needed to scan more than two sectors to find an object
+/  gets an index of its names in a block taken by ff_memalloc(), and later look-ups
+/  in it read only the sector with the entry. The index is kept up to date when
+/  an object is created, renamed or removed. The least recently used index is
+/  discarded for a new one and all indexes are discarded on unmount. */
+
+
+#define FF_FS_DCACHE	16
+/* This option sets the number of entries of the path cache in the filesystem
+/  object (FATFS). (0:Disable or 1-64) When enabled, each path segment found on
+/  the FAT12/16/32 volume is recorded with the start cluster of its directory, the
+/  location of its entry and its own start cluster, so that following the same
+/  path again does not read the intermediate directories. Names longer than 31
+/  characters and dot names are not recorded. An entry is removed with the object
+/  it refers to and all entries are discarded on mount. */
+
+
+#define FF_FS_FCACHE	8
+/* This option sets the number of entries of the last cluster cache in the
+/  filesystem object (FATFS). (0:Disable or 1-64) When enabled, f_close() records
+/  the last cluster of a file closed at its end with the start cluster and size of
+/  the file, and f_open() with FA_OPEN_APPEND takes the last cluster from the entry
+/  matching the directory entry instead of following the cluster chain, so that a
+/  large file is reopened for appending in constant time. An entry is removed when
+/  the cluster chain is truncated or removed and all entries are discarded on mount.
+/  This option has no effect at FF_FS_READONLY == 1. */
+
+
+#define FF_FS_DIRSCAN	1
+/* This option switches the block scan of directories. (0:Disable or 1:Enable)
+/  When enabled, looking up, allocating and reading entries of a FAT12/16/32
+/  directory test 16 entries at a time for the end of directory, deleted entries,
+/  the SFN to find and LFN entries with SSE2/AVX2/NEON instructions when the
+/  compiler targets them, or with portable code, and skip the entries that need
+/  no further processing. */
+
+
+#define FF_FS_LAZYFAT2	0
+/* This option switches the deferred update of the 2nd FAT. (0:Disable or 1:Enable)
+/  When enabled, a FAT sector written back from the window on a FAT12/16/32 volume
+/  with two FATs is only marked in a bitmap taken by ff_memalloc(), and the marked
+/  sectors are copied from the 1st FAT to the 2nd FAT in runs of multi-sector
+/  transfers when the filesystem is synchronized (f_sync(), f_close() and such).
+/  Until then, the 2nd FAT can be older than the 1st FAT which is always used, so
+/  a power loss before the sync leaves no up-to-date backup of the modified FAT
+/  sectors. When the bitmap cannot be allocated, each sector is reflected as it is
+/  written. */
+
+
+#define FF_USE_FILEBUF	1
+/* This option switches f_setbuf(). (0:Disable or 1:Enable) f_setbuf() attaches a
+/  buffer given by the application to an open file, typically right after f_open().
+/  Its size is any number of sectors, e.g. the cluster size. Data sectors completed
+/  by f_write() are collected in the buffer while they are contiguous on the volume,
+/  and written in a multi-sector transfer when the buffer gets full, a sector off
+/  the run is completed, or the file is synchronized. While f_read() continues from
+/  where the last read ended, the buffer is also used to read ahead the following
+/  sectors of the file in a multi-sector transfer, doubling the number of sectors
+/  on each refill up to the buffer size. A random access stops the read-ahead.
+/  This option cannot be used at FF_FS_TINY = 1. */
+
+
+#define FF_USE_SYNCV	1
+/* This option switches f_syncv(). (0:Disable or 1:Enable) f_syncv() synchronizes
+/  a group of open files on a volume at a time. The cached data of the files are
+/  flushed first, the directory entries are updated in ascending order of sector so
+/  that each directory sector is written once, and then the FAT sectors and FSINFO
+/  are written back once in ascending order of sector. A file in hard error is
+/  skipped and its error is returned. Also FF_FS_READONLY needs to be 0 to enable
+/  this option. */
+
+
+#define FF_USE_READVIEW	1
+/* This option switches f_readview(). (0:Disable or 1:Enable) f_readview() reads
+/  data from the file without copy. It returns a pointer to the data in the sector
+/  buffer of the file object, or in the read-ahead sectors of the buffer attached
+/  by f_setbuf() up to the end of the cluster, and moves the file pointer over the
+/  returned data. The data is read-only and valid until the next access to the
+/  file object (or to the volume at FF_FS_TINY = 1), so nothing needs releasing. */
+
+
+#define FF_USE_IOVEC	1
+/* This option switches f_readv() and f_writev(). (0:Disable or 1:Enable) They read
+/  or write a list of data buffers in one call with one validation of the file
+/  object. The whole sectors in each buffer are transferred directly in
+/  multi-sector transfers and, with FF_FS_BULKALLOC, the clusters for the whole
+/  transfer are allocated at a time. f_writev() needs FF_FS_READONLY = 0. */
+
+
 #define FF_FS_EXFAT		0
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
@@ -289,7 +462,9 @@
 /      should avoid illegal open, remove and rename to the open objects.
 /  >0: Enable file lock function. The value defines how many files/sub-directories
 /      can be opened simultaneously under file lock control. Note that the file
-/      lock control is independent of re-entrancy. */
+/      lock control is independent of re-entrancy. The open objects are looked up
+/      in a hash table, so that the value can be thousands without slowing down
+/      the file open. */
 
 
 #define FF_FS_REENTRANT	0
@@ -304,8 +479,18 @@
 /   1: Enable re-entrancy. Also user provided synchronization handlers,
 /      ff_mutex_create(), ff_mutex_delete(), ff_mutex_take() and ff_mutex_give(),
 /      must be added to the project. Samples are available in ffsystem.c.
+/   2: Enable re-entrancy with object locks. In addition to 1, each open object
+/      has its own mutex. f_read(), f_readv() and f_readview() take only the mutex
+/      of the file and take the volume mutex just while following the FAT, so that
+/      reads of different files run in parallel when the disk I/O layer allows
+/      it. Other functions take the object mutex prior to the volume mutex.
+/      f_syncv() takes the mutexes of all the files in ascending order of lock ID.
+/      FF_FS_LOCK must be >0 and FF_FS_TINY must be 0.
 /
-/  The FF_FS_TIMEOUT defines timeout period in unit of O/S time tick.
+/  The FF_FS_TIMEOUT defines timeout period in unit of O/S time tick (ms at POSIX
+/  threads in ffsystem.c). The POSIX sample measures it in the monotonic clock
+/  with glibc 2.30 or later and _GNU_SOURCE, or else in the wall clock, so that a
+/  step of the system time shortens or stretches the timeout.
 */
 
 
@@ -5,7 +5,7 @@
 #include "ff.h"
 
 
-#if FF_USE_LFN == 3	/* Use dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_FS_FATRAM || FF_FS_FREEMAP || FF_FS_FATSCAN || FF_FS_DIRINDEX || FF_FS_LAZYFAT2	/* Use dynamic memory allocation */
 
 /*------------------------------------------------------------------------*/
 /* Allocate/Free a Memory Block                                           */
@@ -39,30 +39,46 @@ void ff_memfree (
 /* Definitions of Mutex                                                   */
 /*------------------------------------------------------------------------*/
 
-#define OS_TYPE	0	/* 0:Win32, 1:uITRON4.0, 2:uC/OS-II, 3:FreeRTOS, 4:CMSIS-RTOS */
+#define OS_TYPE	5	/* 0:Win32, 1:uITRON4.0, 2:uC/OS-II, 3:FreeRTOS, 4:CMSIS-RTOS, 5:POSIX threads */
+
+#if FF_FS_REENTRANT == 2
+#define N_MUTEX	(FF_VOLUMES + 1 + FF_FS_LOCK)	/* Volume mutexes, system mutex and object mutexes */
+#else
+#define N_MUTEX	(FF_VOLUMES + 1)				/* Volume mutexes and system mutex */
+#endif
 
 
 #if   OS_TYPE == 0	/* Win32 */
 #include <windows.h>
-static HANDLE Mutex[FF_VOLUMES + 1];	/* Table of mutex handle */
+static HANDLE Mutex[N_MUTEX];	/* Table of mutex handle */
 
 #elif OS_TYPE == 1	/* uITRON */
 #include "itron.h"
 #include "kernel.h"
-static mtxid Mutex[FF_VOLUMES + 1];		/* Table of mutex ID */
+static mtxid Mutex[N_MUTEX];		/* Table of mutex ID */
 
 #elif OS_TYPE == 2	/* uc/OS-II */
 #include "includes.h"
-static OS_EVENT *Mutex[FF_VOLUMES + 1];	/* Table of mutex pinter */
+static OS_EVENT *Mutex[N_MUTEX];	/* Table of mutex pinter */
 
 #elif OS_TYPE == 3	/* FreeRTOS */
 #include "FreeRTOS.h"
 #include "semphr.h"
-static SemaphoreHandle_t Mutex[FF_VOLUMES + 1];	/* Table of mutex handle */
+static SemaphoreHandle_t Mutex[N_MUTEX];	/* Table of mutex handle */
 
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 #include "cmsis_os.h"
-static osMutexId Mutex[FF_VOLUMES + 1];	/* Table of mutex ID */
+static osMutexId Mutex[N_MUTEX];	/* Table of mutex ID */
+
+#elif OS_TYPE == 5	/* POSIX threads */
+#include <pthread.h>
+#include <time.h>
+static pthread_mutex_t Mutex[N_MUTEX];	/* Table of mutex */
+#if defined __USE_GNU && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define CLOCKLOCK	1	/* Timeout in the monotonic clock with pthread_mutex_clocklock() (compiled with _GNU_SOURCE) */
+#else
+#define CLOCKLOCK	0	/* Timeout in the wall clock with pthread_mutex_timedlock() */
+#endif
 
 #endif
 
@@ -77,7 +93,7 @@ static osMutexId Mutex[FF_VOLUMES + 1];	/* Table of mutex ID */
 */
 
 int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the mutex */
-	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or object mutex (FF_VOLUMES + 1 to FF_VOLUMES + FF_FS_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -106,6 +122,9 @@ int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the
 	Mutex[vol] = osMutexCreate(osMutex(cmsis_os_mutex));
 	return (int)(Mutex[vol] != NULL);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	return (int)(pthread_mutex_init(&Mutex[vol], NULL) == 0);
+
 #endif
 }
 
@@ -118,7 +137,7 @@ int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the
 */
 
 void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due to an error */
-	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or object mutex (FF_VOLUMES + 1 to FF_VOLUMES + FF_FS_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -138,6 +157,9 @@ void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	osMutexDelete(Mutex[vol]);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	pthread_mutex_destroy(&Mutex[vol]);
+
 #endif
 }
 
@@ -150,7 +172,7 @@ void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due
 */
 
 int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
-	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or object mutex (FF_VOLUMES + 1 to FF_VOLUMES + FF_FS_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -171,6 +193,25 @@ int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	return (int)(osMutexWait(Mutex[vol], FF_FS_TIMEOUT) == osOK);
 
+#elif OS_TYPE == 5	/* POSIX threads (FF_FS_TIMEOUT in unit of ms) */
+	struct timespec ts;
+
+#if CLOCKLOCK
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+	ts.tv_sec += FF_FS_TIMEOUT / 1000;
+	ts.tv_nsec += (long)(FF_FS_TIMEOUT % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++; ts.tv_nsec -= 1000000000;
+	}
+#if CLOCKLOCK
+	return (int)(pthread_mutex_clocklock(&Mutex[vol], CLOCK_MONOTONIC, &ts) == 0);
+#else
+	return (int)(pthread_mutex_timedlock(&Mutex[vol], &ts) == 0);
+#endif
+
 #endif
 }
 
@@ -183,7 +224,7 @@ int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
 */
 
 void ff_mutex_give (
-	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or object mutex (FF_VOLUMES + 1 to FF_VOLUMES + FF_FS_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -201,6 +242,9 @@ void ff_mutex_give (
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	osMutexRelease(Mutex[vol]);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	pthread_mutex_unlock(&Mutex[vol]);
+
 #endif
 }
 
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ff.h"
+#include "diskio.h"
+#include "disktrace.h"
+
+// Re-issue a block I/O trace recorded by diskio.c against a backend, either
+// as fast as possible or with the original timing, and compare latencies.
+
+static const char *op_name[] = { "read", "write", "ioctl" };
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t t) {
+    uint64_t n = now_us();
+    if (t > n) {
+        struct timespec ts = { (time_t)((t - n) / 1000000), (long)((t - n) % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void usage(void) {
+    printf("Usage: replay [-t] [-i [drv:]image]... [-d [drv:]spidev]... <trace>\n");
+    printf("  -t          keep the original inter-arrival timing\n");
+    printf("  -i image    serve a drive (default 0) from a disk image file\n");
+    printf("  -d spidev   serve a drive (default 0) from the SD card on an SPI device\n");
+    printf("Drives not given keep their default (drive 0: SD card on /dev/spidev0.0).\n");
+    printf("Writes carry synthetic data: never replay against a card you need.\n");
+}
+
+// Attach a "[drv:]path" argument to its drive
+static int attach(const char *arg, int image) {
+    BYTE pdrv = 0;
+
+    if (arg[0] >= '0' && arg[0] <= '9' && arg[1] == ':') {
+        pdrv = arg[0] - '0';
+        arg += 2;
+    }
+    if (!(image ? disk_attach_image(pdrv, arg) : disk_attach_sd(pdrv, arg))) {
+        printf("Cannot attach %s to drive %u\n", arg, pdrv);
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int timed = 0, opt;
+
+    while ((opt = getopt(argc, argv, "ti:d:h")) != -1) {
+        switch (opt) {
+        case 't': timed = 1; break;
+        case 'i': if (!attach(optarg, 1)) return 1; break;
+        case 'd': if (!attach(optarg, 0)) return 1; break;
+        default: usage(); return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f) {
+        perror(argv[optind]);
+        return 1;
+    }
+    DTHDR hdr;
+    if (fread(&hdr, sizeof hdr, 1, f) != 1 || hdr.magic != DT_MAGIC || hdr.version != DT_VERSION) {
+        printf("%s: not a trace file\n", argv[optind]);
+        return 1;
+    }
+
+    BYTE *buf = NULL, inited[256] = { 0 };
+    UINT bufsect = 0;
+    unsigned long n_ops[3] = { 0 }, n_sect[3] = { 0 }, n_err = 0;
+    uint64_t lat_orig[3] = { 0 }, lat_new[3] = { 0 };
+    uint64_t t_start = now_us(), ts_first = 0;
+    int first = 1;
+    DTREC rec;
+
+    while (fread(&rec, sizeof rec, 1, f) == 1) {
+        if (rec.op > DT_IOCTL) continue;
+        if (first) {
+            ts_first = rec.ts;
+            first = 0;
+        }
+        if (timed) sleep_until(t_start + (rec.ts - ts_first));
+
+        if (!inited[rec.pdrv]) {
+            disk_initialize(rec.pdrv);
+            inited[rec.pdrv] = 1;
+        }
+        if (rec.op != DT_IOCTL && rec.count > bufsect) {
+            bufsect = rec.count;
+            buf = realloc(buf, (size_t)bufsect * 512);
+            memset(buf, 0xA5, (size_t)bufsect * 512);
+        }
+
+        uint64_t t0 = now_us();
+        DRESULT res;
+        if (rec.op == DT_READ) {
+            res = disk_read(rec.pdrv, buf, rec.lba, rec.count);
+        } else if (rec.op == DT_WRITE) {
+            res = disk_write(rec.pdrv, buf, rec.lba, rec.count);
+        } else {
+            LBA_t arg[16] = { rec.lba, rec.lba + rec.count - 1 };   // CTRL_TRIM/CTRL_ZERO range or scratch for GET_*
+            res = disk_ioctl(rec.pdrv, rec.cmd, arg);
+        }
+        uint64_t lat = now_us() - t0;
+
+        if (res != (DRESULT)rec.res) n_err++;
+        n_ops[rec.op]++;
+        if (rec.op != DT_IOCTL) n_sect[rec.op] += rec.count;
+        lat_orig[rec.op] += rec.lat;
+        lat_new[rec.op] += lat;
+    }
+    uint64_t elapsed = now_us() - t_start;
+
+    printf("%-6s %10s %10s %14s %16s\n", "op", "calls", "sectors", "orig avg [us]", "replay avg [us]");
+    for (int i = 0; i < 3; i++) {
+        if (!n_ops[i]) continue;
+        printf("%-6s %10lu %10lu %14.1f %16.1f\n", op_name[i], n_ops[i], n_sect[i],
+               (double)lat_orig[i] / n_ops[i], (double)lat_new[i] / n_ops[i]);
+    }
+    printf("Replayed in %.3f s (%s), %lu results differ from the trace\n",
+           elapsed / 1e6, timed ? "original timing" : "as fast as possible", n_err);
+
+    free(buf);
+    fclose(f);
+    return 0;
+}
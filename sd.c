@@ -10,33 +10,79 @@
 # include "sd.h"
 
 
-int spi_fd = -1;
+// --- Device handle ---
+int sd_open(sd_dev_t *dev, const char *path) {
+    memset(dev, 0, sizeof *dev);
+    dev->speed = 125000;   // 125 kHz init speed
+    dev->bits = 8;
+    dev->fd = open(path, O_RDWR);
+    if (dev->fd < 0) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+void sd_close(sd_dev_t *dev) {
+    if (dev->fd >= 0) {
+        sd_sync(dev);
+        close(dev->fd);
+    }
+    dev->fd = -1;
+    dev->type = 0;
+}
 
 // --- SPI helpers ---
-uint8_t xchg_spi(uint8_t val) {
+static uint8_t xchg_spi(sd_dev_t *dev, uint8_t val) {
     uint8_t tx[1] = {val};
     uint8_t rx[1] = {0};
     struct spi_ioc_transfer tr = {
         .tx_buf = (unsigned long)tx,
         .rx_buf = (unsigned long)rx,
         .len = 1,
-        .speed_hz = speed,
-        .bits_per_word = bits,
+        .speed_hz = dev->speed,
+        .bits_per_word = dev->bits,
     };
-    if (ioctl(spi_fd, SPI_IOC_MESSAGE(1), &tr) < 1) {
+    if (ioctl(dev->fd, SPI_IOC_MESSAGE(1), &tr) < 1) {
         perror("SPI_IOC_MESSAGE");
         exit(1);
     }
     return rx[0];
 }
 
-void deselect() {
-    xchg_spi(0xFF); // one dummy byte with CS high
+static void deselect(sd_dev_t *dev) {
+    xchg_spi(dev, 0xFF); // one dummy byte with CS high
+}
+
+// Poll until the card releases busy (MISO high). Each poll is a full SPI
+// transfer, so no extra sleep is needed between polls.
+static int wait_ready(sd_dev_t *dev) {
+    time_t t0 = time(NULL);
+    while (xchg_spi(dev, 0xFF) != 0xFF) {
+        dev->stats.busy_polls++;
+        if (time(NULL) - t0 > 1) {
+            printf("Card busy timeout\n");
+            dev->stats.errors++;
+            return 0;
+        }
+    }
+    dev->busy = 0;
+    return 1;
+}
+
+// Wait for the programming of a pipelined write to finish
+int sd_sync(sd_dev_t *dev) {
+    return dev->busy ? wait_ready(dev) : 1;
 }
 
 // --- SD command helpers ---
-uint8_t send_cmd(uint8_t cmd, uint32_t arg, uint8_t crc) {
+static uint8_t send_cmd(sd_dev_t *dev, uint8_t cmd, uint32_t arg, uint8_t crc) {
     uint8_t buf[6];
+
+    // A pipelined write may still be programming
+    if (dev->busy && !wait_ready(dev)) return 0xFF;
+    dev->stats.cmds++;
+
     buf[0] = 0x40 | cmd;
     buf[1] = (arg >> 24) & 0xFF;
     buf[2] = (arg >> 16) & 0xFF;
@@ -45,81 +91,139 @@ uint8_t send_cmd(uint8_t cmd, uint32_t arg, uint8_t crc) {
     buf[5] = crc;
 
     // send command
-    for (int i = 0; i < 6; i++) xchg_spi(buf[i]);
+    for (int i = 0; i < 6; i++) xchg_spi(dev, buf[i]);
 
     // wait for response (max 8 bytes)
     for (int i = 0; i < 8; i++) {
-        uint8_t r = xchg_spi(0xFF);
+        uint8_t r = xchg_spi(dev, 0xFF);
         if (r != 0xFF) return r;
     }
     return 0xFF;
 }
 
-void send_cmd_r7(uint8_t *resp) {
-    for (int i = 0; i < 4; i++) resp[i] = xchg_spi(0xFF);
+static void send_cmd_r7(sd_dev_t *dev, uint8_t *resp) {
+    for (int i = 0; i < 4; i++) resp[i] = xchg_spi(dev, 0xFF);
 }
 
-void send_cmd_r3(uint8_t *resp) {
-    for (int i = 0; i < 4; i++) resp[i] = xchg_spi(0xFF);
+static void send_cmd_r3(sd_dev_t *dev, uint8_t *resp) {
+    for (int i = 0; i < 4; i++) resp[i] = xchg_spi(dev, 0xFF);
+}
+
+// Receive a data block that follows a read command
+static int rcvr_datablock(sd_dev_t *dev, uint8_t *buf, int len) {
+    // Wait for data token 0xFE
+    uint8_t token;
+    int timeout = 10000;
+    do {
+        token = xchg_spi(dev, 0xFF);
+    } while (token == 0xFF && --timeout);
+
+    if (token != 0xFE) {
+        printf("Read timeout or bad token: 0x%02X\n", token);
+        dev->stats.errors++;
+        return 0;
+    }
+
+    for (int i = 0; i < len; i++) {
+        buf[i] = xchg_spi(dev, 0xFF);
+    }
+
+    // Read 2-byte CRC (ignored here)
+    xchg_spi(dev, 0xFF);
+    xchg_spi(dev, 0xFF);
+    return 1;
 }
 
 // --- SD initialization ---
-int sd_init() {
-    CardType = 0;
+int sd_init(sd_dev_t *dev) {
+    int type = 0;
+
+    dev->speed = 125000;   // Identification at 125 kHz
+    dev->busy = 0;
 
     // 80 dummy clocks
-    for (int i = 0; i < 10; i++) xchg_spi(0xFF);
+    for (int i = 0; i < 10; i++) xchg_spi(dev, 0xFF);
 
     // CMD0: go idle
-    if (send_cmd(0, 0, 0x95) != 0x01) {
+    if (send_cmd(dev, 0, 0, 0x95) != 0x01) {
         printf("No response to CMD0\n");
+        dev->stats.errors++;
         return 0;
     }
 
     // CMD8: check SD v2
-    if (send_cmd(8, 0x1AA, 0x87) == 0x01) {
+    if (send_cmd(dev, 8, 0x1AA, 0x87) == 0x01) {
         uint8_t r7[4];
-        send_cmd_r7(r7);
+        send_cmd_r7(dev, r7);
         if (r7[2] == 0x01 && r7[3] == 0xAA) {
             // v2 card, ACMD41 with HCS
             time_t t0 = time(NULL);
             uint8_t resp;
             do {
-                send_cmd(55, 0, 0x01);
-                resp = send_cmd(41, 1UL<<30, 0x01);
+                send_cmd(dev, 55, 0, 0x01);
+                resp = send_cmd(dev, 41, 1UL<<30, 0x01);
             } while (resp != 0x00 && (time(NULL) - t0) < 1);
-            if (resp == 0x00 && send_cmd(58, 0, 0x01) == 0x00) {
+            if (resp == 0x00 && send_cmd(dev, 58, 0, 0x01) == 0x00) {
                 uint8_t ocr[4];
-                send_cmd_r3(ocr);
+                send_cmd_r3(dev, ocr);
                 if (ocr[0] & 0x40) {
-                    CardType = CT_SD2 | CT_BLOCK; // SDHC
+                    type = CT_SD2 | CT_BLOCK; // SDHC
                 } else {
-                    CardType = CT_SD2; // SDSC
+                    type = CT_SD2; // SDSC
                 }
             }
         }
     } else {
         // v1 or MMC
         uint8_t cmd;
-        if (send_cmd(55, 0, 0x01) <= 1 && send_cmd(41, 0, 0x01) <= 1) {
-            CardType = CT_SD1; cmd = 41;
+        if (send_cmd(dev, 55, 0, 0x01) <= 1 && send_cmd(dev, 41, 0, 0x01) <= 1) {
+            type = CT_SD1; cmd = 41;
         } else {
-            CardType = CT_MMC; cmd = 1;
+            type = CT_MMC; cmd = 1;
         }
         time_t t0 = time(NULL);
-        while (send_cmd(cmd, 0, 0x01) != 0x00 && (time(NULL) - t0) < 1);
+        while (send_cmd(dev, cmd, 0, 0x01) != 0x00 && (time(NULL) - t0) < 1);
 
-        if (!(CardType & CT_BLOCK)) {
-            if (send_cmd(16, 512, 0x01) != 0x00) CardType = 0;
+        if (!(type & CT_BLOCK)) {
+            if (send_cmd(dev, 16, 512, 0x01) != 0x00) type = 0;
         }
     }
 
-    deselect();
-
-    if (CardType) {
-        speed = 4000000; // 4 MHz after init
-        ioctl(spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-        printf("SD card initialized. Type: %d\n", CardType);
+    deselect(dev);
+
+    dev->type = type;
+    dev->block_addr = (type & CT_BLOCK) != 0;
+    dev->erase_zero = 0;
+    dev->erase_unit = 1;
+    dev->pre_erase = (type & (CT_SD1 | CT_SD2)) != 0;
+    if (type & (CT_SD1 | CT_SD2)) {
+        // ACMD51: SCR tells what erased blocks read as
+        uint8_t scr[8];
+        if (send_cmd(dev, 55, 0, 0x01) <= 1 && send_cmd(dev, 51, 0, 0x01) == 0x00 && rcvr_datablock(dev, scr, 8)) {
+            dev->erase_zero = !(scr[1] & 0x80);
+        }
+        deselect(dev);
+        // CMD9: CSD tells how many blocks CMD38 erases at a time. CSD v2 cards
+        // erase any block; a v1 card without ERASE_BLK_EN erases whole
+        // SECTOR_SIZE groups around the given range.
+        uint8_t csd[16];
+        if (dev->erase_zero && send_cmd(dev, 9, 0, 0x01) == 0x00 && rcvr_datablock(dev, csd, 16)) {
+            if ((csd[0] >> 6) == 1 || (csd[10] & 0x40)) {
+                dev->erase_unit = 1;
+            } else {
+                uint32_t sector_size = (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1;
+                uint32_t write_bl_len = ((csd[12] & 0x03) << 2) | (csd[13] >> 6);
+                dev->erase_unit = write_bl_len >= 9 ? sector_size << (write_bl_len - 9) : sector_size;
+            }
+        } else {
+            dev->erase_zero = 0;    // Unknown erase unit: do not erase
+        }
+        deselect(dev);
+    }
+    if (type) {
+        dev->speed = 4000000; // 4 MHz after init
+        ioctl(dev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &dev->speed);
+        printf("SD card initialized. Type: %d\n", type);
         return 1;
     } else {
         printf("SD init failed\n");
@@ -127,80 +231,156 @@ int sd_init() {
     }
 }
 
-int sd_read_block(uint32_t block, uint8_t *buf) {
-    uint32_t addr = (CardType & CT_BLOCK) ? block : block * 512;
+int sd_read_block(sd_dev_t *dev, uint32_t block, uint8_t *buf) {
+    uint32_t addr = dev->block_addr ? block : block * 512;
 
-    if (send_cmd(17, addr, 0x01) != 0x00) {
+    if (send_cmd(dev, 17, addr, 0x01) != 0x00) {
         printf("CMD17 failed\n");
+        dev->stats.errors++;
         return 0;
     }
 
-    // Wait for data token 0xFE
-    uint8_t token;
-    int timeout = 10000;
-    do {
-        token = xchg_spi(0xFF);
-    } while (token == 0xFF && --timeout);
-
-    if (token != 0xFE) {
-        printf("Read timeout or bad token: 0x%02X\n", token);
-        return 0;
-    }
-
-    // Read 512 bytes
-    for (int i = 0; i < 512; i++) {
-        buf[i] = xchg_spi(0xFF);
-    }
-
-    // Read 2-byte CRC (ignored here)
-    xchg_spi(0xFF);
-    xchg_spi(0xFF);
+    if (!rcvr_datablock(dev, buf, 512)) return 0;
 
-    deselect();
+    deselect(dev);
+    dev->stats.blocks_read++;
     return 1;
 }
 
-#include "spi.h"
-#include <stdio.h>
-#include <unistd.h>
-
 // Send a single 512-byte block to the SD card
-int sd_write_block(uint32_t block, const uint8_t *buf) {
-    uint32_t addr = (CardType & CT_BLOCK) ? block : block * 512;
+int sd_write_block(sd_dev_t *dev, uint32_t block, const uint8_t *buf) {
+    uint32_t addr = dev->block_addr ? block : block * 512;
 
     // Send CMD24 (WRITE_SINGLE_BLOCK)
-    if (send_cmd(24, addr, 0x01) != 0x00) {
+    if (send_cmd(dev, 24, addr, 0x01) != 0x00) {
         printf("CMD24 failed\n");
+        dev->stats.errors++;
         return 0;
     }
 
     // Send one byte gap
-    xchg_spi(0xFF);
+    xchg_spi(dev, 0xFF);
 
     // Send start token (0xFE)
-    xchg_spi(0xFE);
+    xchg_spi(dev, 0xFE);
 
     // Send 512 bytes of data
     for (int i = 0; i < 512; i++) {
-        xchg_spi(buf[i]);
+        xchg_spi(dev, buf[i]);
     }
 
     // Send dummy CRC
-    xchg_spi(0xFF);
-    xchg_spi(0xFF);
+    xchg_spi(dev, 0xFF);
+    xchg_spi(dev, 0xFF);
 
     // Get data response token
-    uint8_t resp = xchg_spi(0xFF);
+    uint8_t resp = xchg_spi(dev, 0xFF);
     if ((resp & 0x1F) != 0x05) {
         printf("Write rejected, resp=0x%02X\n", resp);
+        dev->stats.errors++;
         return 0;
     }
+    dev->stats.blocks_written++;
 
-    // Wait for card to finish programming
-    while (xchg_spi(0xFF) == 0x00) {
-        usleep(1000); // small delay
-    }
+    // Card programs the block now; let the host prepare the next one
+    dev->busy = 1;
+#if !SD_WRITE_PIPELINE
+    if (!wait_ready(dev)) return 0;
+#endif
 
     return 1; // success
 }
 
+// Send a run of 512-byte blocks with one CMD25 (WRITE_MULTIPLE_BLOCK)
+int sd_write_blocks(sd_dev_t *dev, uint32_t block, const uint8_t *buf, uint32_t count) {
+    if (count == 1) return sd_write_block(dev, block, buf);
+
+    uint32_t addr = dev->block_addr ? block : block * 512;
+
+    // ACMD23: tell SD cards how many blocks to pre-erase. It is only a hint,
+    // so a card that rejects it gets plain CMD25 from now on.
+    if (dev->pre_erase) {
+        if (send_cmd(dev, 55, 0, 0x01) > 1 || send_cmd(dev, 23, count, 0x01) != 0x00) {
+            printf("ACMD23 rejected, writing without pre-erase\n");
+            dev->stats.errors++;
+            dev->pre_erase = 0;
+        }
+    }
+
+    if (send_cmd(dev, 25, addr, 0x01) != 0x00) {
+        printf("CMD25 failed\n");
+        dev->stats.errors++;
+        return 0;
+    }
+
+    // Send one byte gap
+    xchg_spi(dev, 0xFF);
+
+    int ok = 1;
+    for (uint32_t n = 0; n < count; n++, buf += 512) {
+        // Multi-block start token (0xFC)
+        xchg_spi(dev, 0xFC);
+
+        for (int i = 0; i < 512; i++) {
+            xchg_spi(dev, buf[i]);
+        }
+
+        // Send dummy CRC
+        xchg_spi(dev, 0xFF);
+        xchg_spi(dev, 0xFF);
+
+        uint8_t resp = xchg_spi(dev, 0xFF);
+        if ((resp & 0x1F) != 0x05) {
+            printf("Write rejected at block %u, resp=0x%02X\n", block + n, resp);
+            dev->stats.errors++;
+            ok = 0;
+            break;
+        }
+        dev->stats.blocks_written++;
+
+        // Wait for card to finish programming this block
+        if (!wait_ready(dev)) {
+            ok = 0;
+            break;
+        }
+    }
+
+    // Stop transmission token (0xFD); the card goes busy for the last block
+    xchg_spi(dev, 0xFD);
+    xchg_spi(dev, 0xFF);
+    dev->busy = 1;
+#if !SD_WRITE_PIPELINE
+    if (!wait_ready(dev)) ok = 0;
+#endif
+
+    return ok;
+}
+
+// Erase blocks start..end (inclusive) with CMD32/CMD33/CMD38 (SD cards only).
+// Unless erase_unit is 1, the card erases whole units around the range, so
+// start and end + 1 should be multiples of erase_unit.
+int sd_erase(sd_dev_t *dev, uint32_t start, uint32_t end) {
+    if (!(dev->type & (CT_SD1 | CT_SD2))) return 0;
+    if (!dev->block_addr) {
+        start *= 512;
+        end *= 512;
+    }
+
+    if (send_cmd(dev, 32, start, 0x01) != 0x00 || send_cmd(dev, 33, end, 0x01) != 0x00) {
+        printf("CMD32/CMD33 failed\n");
+        dev->stats.errors++;
+        return 0;
+    }
+    if (send_cmd(dev, 38, 0, 0x01) != 0x00) {
+        printf("CMD38 failed\n");
+        dev->stats.errors++;
+        return 0;
+    }
+
+    // The card is busy while erasing; the next command waits for it
+    dev->busy = 1;
+#if !SD_WRITE_PIPELINE
+    if (!wait_ready(dev)) return 0;
+#endif
+    return 1;
+}
@@ -1,6 +1,8 @@
 #ifndef SD_H
 #define SD_H
 
+#include <stdint.h>
+
 #define DEVICE "/dev/spidev0.0"
 // Card type flags
 #define CT_SD1   0x01
@@ -8,12 +10,42 @@
 #define CT_BLOCK 0x04
 #define CT_MMC   0x08
 
-extern int spi_fd;
-uint32_t speed = 125000;   // 125 kHz init speed
-uint8_t bits = 8;
-int CardType = 0;
+// Return from a write once the card has accepted the data and let the next
+// command (or sd_sync) wait for the end of programming
+#ifndef SD_WRITE_PIPELINE
+#define SD_WRITE_PIPELINE 1
+#endif
+
+// Transfer counters of a card
+typedef struct {
+    uint32_t cmds;          // Commands sent
+    uint32_t blocks_read;   // 512-byte blocks read
+    uint32_t blocks_written;// 512-byte blocks written
+    uint32_t busy_polls;    // Bytes clocked while waiting for the card
+    uint32_t errors;        // Failed commands and rejected data
+} sd_stats_t;
+
+// One card on one SPI device. Nothing is shared between handles, so
+// separate cards can be driven from separate threads.
+typedef struct {
+    int fd;                 // spidev file descriptor (-1: closed)
+    uint32_t speed;         // SPI clock [Hz]
+    uint8_t bits;           // Bits per word
+    int type;               // Card type flags (CT_*, 0: not initialized)
+    int block_addr;         // 1: block addressing (SDHC/SDXC), 0: byte addressing
+    int busy;               // A write returned before the card finished programming
+    int erase_zero;         // 1: erased blocks read as zeros (SCR DATA_STAT_AFTER_ERASE is 0)
+    uint32_t erase_unit;    // Blocks erased at a time by CMD38 (1: any block, CSD ERASE_BLK_EN is 1)
+    int pre_erase;          // 1: send ACMD23 before CMD25 (cleared when the card rejects it)
+    sd_stats_t stats;
+} sd_dev_t;
 
-int sd_init();
-int sd_read_block(uint32_t block, uint8_t *buf);
-int sd_write_block(uint32_t block, const uint8_t *buf);
+int sd_open(sd_dev_t *dev, const char *path);
+void sd_close(sd_dev_t *dev);
+int sd_init(sd_dev_t *dev);
+int sd_read_block(sd_dev_t *dev, uint32_t block, uint8_t *buf);
+int sd_write_block(sd_dev_t *dev, uint32_t block, const uint8_t *buf);
+int sd_write_blocks(sd_dev_t *dev, uint32_t block, const uint8_t *buf, uint32_t count);
+int sd_sync(sd_dev_t *dev);
+int sd_erase(sd_dev_t *dev, uint32_t start, uint32_t end);
 #endif